@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "nodePool.h"
+
+template <typename T, typename Alloc = NodePool<T>>
+struct EpochReclaimer
+{
+    // Epoch based reclamation (Fraser), shared by the lists and the trees.
+    // Every operation runs inside a Guard, and whoever wins the CAS that unlinks a node hands
+    // it to retire(). A node retired in global epoch e is freed once the global epoch reaches
+    // e + 2. The epoch only advances when every active slot has observed the current one, so
+    // no guard that could have seen the node is still running by then. Traversals need no
+    // protect(), and whatever is reachable from a retired node is covered too, which
+    // LockFreeLeafTree needs for its info records. retire() accepts any type Alloc can destroy.
+    // Slots are claimed per guard instead of per thread, so threads never have to register
+    // and nothing is stranded when a thread exits. A guard nested in another guard of the same
+    // reclaimer reuses its slot.
+    typedef Alloc Allocator;
+    static const bool protects = false;
+    static const int MAX_SLOTS = 128;      // max concurrent guards
+    static const int ADVANCE_INTERVAL = 64; // guard exits between epoch advance attempts
+
+    struct Retired
+    {
+        void *ptr;
+        void (*destroy)(void *);
+    };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<bool> in_use{false};
+        std::atomic<unsigned long> epoch{0}; // (local epoch << 1) | active
+        std::vector<Retired> limbo[3];
+        unsigned long limbo_epoch[3] = {0, 0, 0};
+        int exits = 0;
+        int depth = 0; // guards of the owning thread on this slot, nested ones reuse it
+    };
+
+    std::atomic<unsigned long> global_epoch{0};
+    Slot slots[MAX_SLOTS];
+    static inline thread_local Slot *held = nullptr; // innermost slot of this thread
+
+    ~EpochReclaimer()
+    {
+        for (auto &s : slots)
+            for (int i = 0; i < 3; i++)
+                free_limbo(&s, i);
+    }
+
+    struct Guard
+    {
+        EpochReclaimer &r;
+        Slot *outer; // held when the guard was opened, restored when the slot is released
+        Slot *slot;
+        Guard(EpochReclaimer &r) : r(r), outer(held), slot(r.enter()) {}
+        ~Guard() { r.exit(slot, outer); }
+    };
+
+    bool owns(Slot *s)
+    {
+        return std::less<Slot *>()(s, slots + MAX_SLOTS) && !std::less<Slot *>()(s, slots);
+    }
+
+    Slot *enter()
+    {
+        // nested in a guard of this reclaimer : the outer one already keeps the epoch pinned
+        if (held != nullptr && owns(held))
+        {
+            held->depth++;
+            return held;
+        }
+
+        static thread_local unsigned long hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+        int i = hint % MAX_SLOTS;
+        while (true)
+        {
+            bool expected = false;
+            if (!slots[i].in_use.load(std::memory_order_relaxed) &&
+                slots[i].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                break;
+            i = (i + 1) % MAX_SLOTS;
+        }
+        hint = i;
+
+        Slot *s = &slots[i];
+        unsigned long e = global_epoch.load();
+        s->epoch.store((e << 1) | 1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (int b = 0; b < 3; b++)
+        {
+            if (!s->limbo[b].empty() && s->limbo_epoch[b] + 2 <= e)
+                free_limbo(s, b);
+        }
+        s->depth = 1;
+        held = s;
+        return s;
+    }
+
+    void exit(Slot *s, Slot *outer)
+    {
+        if (--s->depth > 0)
+            return;
+        held = outer;
+        s->epoch.store(s->epoch.load(std::memory_order_relaxed) & ~1UL, std::memory_order_release);
+        if (++s->exits % ADVANCE_INTERVAL == 0)
+            try_advance();
+        s->in_use.store(false, std::memory_order_release);
+    }
+
+    void protect(int, T *) {}
+
+    // must be called inside a guard of this reclaimer (the innermost one), after the node
+    // is unreachable
+    template <typename U>
+    void retire(U *node)
+    {
+        Slot *s = held;
+        unsigned long e = global_epoch.load();
+        int b = e % 3;
+        if (s->limbo_epoch[b] != e)
+        {
+            // bucket holds nodes from epoch e - 3 or older, safe to free
+            free_limbo(s, b);
+            s->limbo_epoch[b] = e;
+        }
+        s->limbo[b].push_back(Retired{node, [](void *ptr)
+                                      { Alloc::destroy((U *)ptr); }});
+    }
+
+    void try_advance()
+    {
+        unsigned long e = global_epoch.load();
+        for (auto &s : slots)
+        {
+            unsigned long se = s.epoch.load();
+            if ((se & 1) && (se >> 1) != e)
+                return; // someone is still in an older epoch
+        }
+        global_epoch.compare_exchange_strong(e, e + 1);
+    }
+
+    void free_limbo(Slot *s, int b)
+    {
+        for (Retired &r : s->limbo[b])
+            r.destroy(r.ptr);
+        s->limbo[b].clear();
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <ostream>
+
+template <size_t N>
+struct FixedKey
+{
+    // Fixed size byte string key, stored inline in nodes and ordered like memcmp.
+    // Shorter strings are zero padded.
+    unsigned char bytes[N];
+
+    FixedKey()
+    {
+        std::memset(bytes, 0, N);
+    }
+    FixedKey(const char *str)
+    {
+        size_t len = strnlen(str, N);
+        std::memcpy(bytes, str, len);
+        std::memset(bytes + len, 0, N - len);
+    }
+
+    bool operator<(const FixedKey &other) const
+    {
+        return std::memcmp(bytes, other.bytes, N) < 0;
+    }
+    bool operator==(const FixedKey &other) const
+    {
+        return std::memcmp(bytes, other.bytes, N) == 0;
+    }
+};
+
+template <size_t N>
+std::ostream &operator<<(std::ostream &os, const FixedKey<N> &key)
+{
+    return os.write((const char *)key.bytes, strnlen((const char *)key.bytes, N));
+}
+
+// Largest key of a type, for structures that reserve it as a sentinel
+template <typename K>
+struct KeyLimits
+{
+    static K max()
+    {
+        return std::numeric_limits<K>::max();
+    }
+};
+
+template <size_t N>
+struct KeyLimits<FixedKey<N>>
+{
+    static FixedKey<N> max()
+    {
+        FixedKey<N> key;
+        std::memset(key.bytes, 0xFF, N);
+        return key;
+    }
+};
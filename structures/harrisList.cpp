@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <utility>
@@ -9,28 +10,35 @@
 #include <vector>
 #include <chrono>
 #include <string>
+#include <fstream>
+#include <unistd.h>
 
-struct Node;
+#include "nodePool.h"
+#include "fixedKey.h"
+#include "epochReclaimer.h"
 
-Node *set_mark(Node *ptr)
+template <typename T>
+T *set_mark(T *ptr)
 {
-    return (Node *)((uintptr_t)ptr | 1);
+    return (T *)((uintptr_t)ptr | 1);
 }
-Node *unset_mark(Node *ptr)
+template <typename T>
+T *unset_mark(T *ptr)
 {
     static const uintptr_t mask = ~1;
-    return (Node *)((uintptr_t)ptr & mask);
+    return (T *)((uintptr_t)ptr & mask);
 }
 bool get_mark(void *ptr)
 {
     return (uintptr_t)ptr & 1;
 }
 
-struct Node
+template <typename K>
+struct ListNode
 {
-    int key;
-    std::atomic<Node *> next;
-    Node(int k = 0) : key(k) {}
+    K key; // stored inline, comparisons never chase a pointer
+    std::atomic<ListNode *> next;
+    ListNode(const K &k = K()) : key(k) {}
 
     // print key, ptr, mark for debugging
     void print()
@@ -40,25 +48,125 @@ struct Node
     void debug_info()
     {
         std::cout << " --- Node Debug Info ---" << std::endl;
-        std::cout << "Node size : " << sizeof(Node) << std::endl;
+        std::cout << "Node size : " << sizeof(ListNode) << std::endl;
         std::cout << std::endl;
-        std::cout << "Node next size : " << sizeof(Node *) << std::endl;
+        std::cout << "Node key size : " << sizeof(K) << std::endl;
+        std::cout << "Node next size : " << sizeof(ListNode *) << std::endl;
         std::cout << "Node next is lock free : " << next.is_lock_free() << ", " << std::atomic_is_lock_free(&next) << std::endl;
         std::cout << " --- End of Node Debug Info ---" << std::endl
                   << std::endl;
     }
 };
 
-typedef std::pair<Node *, Node *> NodePair;
+typedef ListNode<int> Node;
+
+// Reclamation policies for unlinked nodes.
+// Every operation runs inside a Guard, and whoever wins the CAS that unlinks a
+// node hands it to retire(). The policy decides when the memory is given back
+// to its Allocator, which the list also uses to create nodes.
+// EpochReclaimer (epochReclaimer.h) is shared with leafTree.cpp.
+
+template <typename T, typename Alloc = NodePool<T>>
+struct LeakReclaimer
+{
+    // unlinked nodes are never freed (original behavior)
+    typedef Alloc Allocator;
+    struct Guard
+    {
+        Guard(LeakReclaimer &) {}
+    };
+    void retire(T *) {}
+};
+
+// Harris search, shared by HarrisList and HarrisMap.
+// Returns adjacent, unmarked (left, right) with left->key < search_key <= right->key,
+// snipping marked nodes in between and retiring them.
+// The caller must hold a guard of reclaimer. If start itself is marked (only possible when
+// start is a cursor left over from an earlier search) returns (nullptr, nullptr).
+template <typename NodeT, typename K, typename Compare, typename Reclaimer>
+std::pair<NodeT *, NodeT *> harris_search(NodeT *start, NodeT *tail, const K &search_key, const Compare &comp, Reclaimer &reclaimer)
+{
+    NodeT *left_node = nullptr, *left_node_next = nullptr, *right_node;
+
+    do
+    {
+        NodeT *t = start;
+        NodeT *t_next = start->next.load();
+        if (get_mark(t_next))
+        {
+            return std::make_pair(nullptr, nullptr);
+        }
+
+        // Find left_node and right_node
+        do
+        {
+            if (!get_mark(t_next))
+            {
+                left_node = t;
+                left_node_next = t_next;
+            }
+            t = unset_mark(t_next);
+            if (t == tail)
+            {
+                break;
+            }
+            t_next = t->next.load();
+
+        } while (get_mark(t_next) || comp(t->key, search_key)); // B1
+        right_node = t;
+
+        // Check if nodes are adjacent
+        if (left_node_next == right_node)
+        {
+            if ((right_node != tail) && get_mark(right_node->next.load()))
+            {
+                continue; // G1
+            }
+            return std::make_pair(left_node, right_node); // R1
+        }
+
+        // Remove one or more marked nodes in between
+        NodeT *_tmp_left_next = unset_mark(left_node_next);
+        bool same_state = left_node->next.compare_exchange_strong(
+            _tmp_left_next, right_node); // C1
+        if (same_state)
+        {
+            // snipped nodes are marked, so their next pointers are frozen
+            NodeT *t = _tmp_left_next;
+            while (t != right_node)
+            {
+                NodeT *t_next = unset_mark(t->next.load());
+                reclaimer.retire(t);
+                t = t_next;
+            }
+
+            if ((right_node != tail) && get_mark(right_node->next.load()))
+            {
+                continue; // G2
+            }
+            return std::make_pair(left_node, right_node); // R2
+        }
+    } while (true); // B2
+}
 
+// Keys are stored inline in the nodes and ordered by Compare.
+// With the defaults (int, std::less<int>) comparisons compile to the same plain < as before.
+template <typename K = int, typename Compare = std::less<K>, typename Reclaimer = EpochReclaimer<ListNode<K>>>
 struct HarrisList
 {
+    typedef ListNode<K> Node;
+    typedef std::pair<Node *, Node *> NodePair;
+    typedef typename Reclaimer::Guard Guard;
+    typedef typename Reclaimer::Allocator Allocator;
+
     Node *head, *tail;
+    Reclaimer reclaimer;
+    Compare comp;
 
     HarrisList()
     {
-        head = new Node();
-        tail = new Node();
+        head = Allocator::create();
+        tail = Allocator::create();
         head->next.store(tail);
     }
 
@@ -68,31 +176,147 @@ struct HarrisList
         while (t != tail)
         {
             Node *tmp = t;
-            t = t->next.load();
-            delete tmp;
+            t = unset_mark(t->next.load());
+            Allocator::destroy(tmp);
         }
-        delete tail;
+        Allocator::destroy(tail);
     }
 
 public:
-    bool insert(int key)
+    bool insert(const K &key)
+    {
+        return insert_from(head, key).second;
+    }
+
+    bool erase(const K &key)
+    {
+        return erase_from(head, key);
+    }
+
+    bool find(const K &key)
+    {
+        return find_from(head, key);
+    }
+
+    bool contains(const K &key)
+    {
+        return contains_from(head, key);
+    }
+
+    // The *_from variants start searching at start instead of head.
+    // start must be a node that is never erased (head, or a sentinel like a bucket in SplitOrderedSet)
+    // and its key must be smaller than key.
+
+    // returns the node holding key and whether it was inserted by this call.
+    // the node is only safe to use after return if it is never erased.
+    std::pair<Node *, bool> insert_from(Node *start, const K &key)
+    {
+        Guard guard(reclaimer);
+        return insert_at(start, key);
+    }
+
+    bool erase_from(Node *start, const K &key)
+    {
+        Guard guard(reclaimer);
+        return erase_at(start, key);
+    }
+
+    // Batches of keys sorted by Compare. The search for each key starts at the left node of
+    // the previous one instead of head, so a sorted batch costs one pass over the list.
+    // Only when that cursor has been erased meanwhile does the search restart from head.
+    // Returns the number of keys inserted / erased.
+    template <typename It>
+    int insert_batch(It first, It last)
     {
-        Node *new_node = new Node(key);
+        Guard guard(reclaimer);
+        Node *cursor = head;
+        int count = 0;
+        for (; first != last; ++first)
+            count += insert_at(cursor, *first).second;
+        return count;
+    }
+
+    template <typename It>
+    int erase_batch(It first, It last)
+    {
+        Guard guard(reclaimer);
+        Node *cursor = head;
+        int count = 0;
+        for (; first != last; ++first)
+            count += erase_at(cursor, *first);
+        return count;
+    }
+
+    bool find_from(Node *start, const K &key)
+    {
+        Guard guard(reclaimer);
+        return found(search(key, start).second, key);
+    }
+
+    // Read-only find (Michael). Walks over marked nodes instead of snipping them and never
+    // restarts, so readers do not write shared cache lines or get restarted by erasers.
+    // A marked node's next pointer is frozen and still leads forward, so the walk always gets
+    // back onto the list. LinP is the load of right_node->next that shows it unmarked.
+    bool contains_from(Node *start, const K &key)
+    {
+        Guard guard(reclaimer);
+        Node *t = unset_mark(start->next.load());
+        while (t != tail && comp(t->key, key))
+            t = unset_mark(t->next.load());
+        return found(t, key) && !get_mark(t->next.load());
+    }
+
+    // caller must hold a guard
+    NodePair search(const K &search_key)
+    {
+        return search(search_key, head);
+    }
+
+    NodePair search(const K &search_key, Node *start)
+    {
+        return harris_search(start, tail, search_key, comp, reclaimer);
+    }
+
+    // right_node as returned by search, key <= right_node->key
+    bool found(Node *right_node, const K &key)
+    {
+        return (right_node != tail) && !comp(key, right_node->key);
+    }
+
+private:
+    // Search from cursor, or from head if cursor was erased, and move cursor to left_node.
+    // cursor->key must be smaller than search_key. Caller must hold a guard.
+    NodePair seek(const K &search_key, Node *&cursor)
+    {
+        NodePair nodes = search(search_key, cursor);
+        if (nodes.first == nullptr)
+            nodes = search(search_key, head);
+        cursor = nodes.first;
+        return nodes;
+    }
+
+    std::pair<Node *, bool> insert_at(Node *&cursor, const K &key)
+    {
+        Node *new_node = nullptr; // allocated on the first CAS attempt, reused on retries
         Node *right_node, *left_node;
 
         do
         {
-            NodePair nodes = search(key);
+            NodePair nodes = seek(key, cursor);
             left_node = nodes.first;
             right_node = nodes.second;
 
             // Already have it
-            if ((right_node != tail) && (right_node->key == key)) // T1
+            if (found(right_node, key)) // T1
             {
-                return false;
+                if (new_node != nullptr)
+                    Allocator::destroy(new_node); // never published
+                return {right_node, false};
             }
 
             // Prepare new node
+            if (new_node == nullptr)
+                new_node = Allocator::create(key);
             new_node->next.store(right_node);
 
             // Swap the new node in
@@ -101,24 +325,24 @@ public:
                 right_node, new_node);
             if (same_state) // C2
             {
-                return true;
+                return {new_node, true};
             }
         } while (true); // B3
     }
 
-    bool erase(int key)
+    bool erase_at(Node *&cursor, const K &key)
     {
         Node *right_node, *left_node;
         Node *right_node_next;
 
         do
         {
-            NodePair nodes = search(key);
+            NodePair nodes = seek(key, cursor);
             left_node = nodes.first;
             right_node = nodes.second; // target node to erase
 
             // Not found
-            if ((right_node == tail) || (right_node->key != key)) // T1
+            if (!found(right_node, key)) // T1
             {
                 return false;
             }
@@ -139,106 +363,667 @@ public:
         // Remove node from list
         bool did_erase = left_node->next.compare_exchange_strong(
             right_node, right_node_next); // C4
-        if (!did_erase)
+        if (did_erase)
         {
-            search(key);
+            reclaimer.retire(right_node);
+        }
+        else
+        {
+            seek(key, cursor); // someone else will unlink and retire it
         }
         return true;
     }
 
-    bool find(int key)
+public:
+
+    void print() // not thread-safe
     {
-        Node *right_node = search(key).second;
-        return (right_node != tail) && (right_node->key == key);
+        int size = 0;
+        std::cout << "--- Printing list: " << std::endl;
+        Node *t = head;
+        while (t != tail)
+        {
+            t->print();
+            size += 1;
+            t = t->next.load();
+        }
+        std::cout << "--- Size: " << size << std::endl;
+        std::cout << "--- End of list" << std::endl;
     }
 
-    NodePair search(int search_key)
+    int size() // not thread-safe
     {
-        Node *left_node, *left_node_next, *right_node;
+        int size = 0;
+        Node *t = head;
+        while (t != tail)
+        {
+            size += 1;
+            t = t->next.load();
+        }
+        return size;
+    }
+
+    long long sum()
+    {
+        long long sum = 0;
+        Node *t = head;
+        while (t != tail)
+        {
+            sum += t->key;
+            t = t->next.load();
+        }
+        return sum;
+    }
+};
+
+template <typename K, typename V>
+struct MapNode
+{
+    K key;
+    std::atomic<V> value;
+    std::atomic<MapNode *> next;
+    MapNode(const K &k = K(), const V &v = V()) : key(k), value(v) {}
+};
+
+template <typename K, typename V, typename Compare = std::less<K>, typename Reclaimer = EpochReclaimer<MapNode<K, V>>>
+struct HarrisMap
+{
+    // Ordered map on the Harris list, sharing harris_search with HarrisList.
+    // Values live in an atomic slot and are changed in place, an update never unlinks the node.
+    // A write can land on a node that got marked after the writer found it. It is then ordered
+    // just before the erase, and nobody reads it since searches never return marked nodes.
+    // V must be trivially copyable, and small enough for std::atomic<V> to be lock-free.
+    typedef MapNode<K, V> MNode;
+    typedef typename Reclaimer::Guard Guard;
+    typedef typename Reclaimer::Allocator Allocator;
+
+    MNode *head, *tail;
+    Reclaimer reclaimer;
+    Compare comp;
+
+    HarrisMap()
+    {
+        head = Allocator::create();
+        tail = Allocator::create();
+        head->next.store(tail);
+    }
+
+    ~HarrisMap()
+    {
+        MNode *t = head;
+        while (t != tail)
+        {
+            MNode *tmp = t;
+            t = unset_mark(t->next.load());
+            Allocator::destroy(tmp);
+        }
+        Allocator::destroy(tail);
+    }
+
+public:
+    // insert if absent
+    bool insert(const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        return insert_with(key, [&]()
+                           { return val; })
+            .second;
+    }
+
+    // returns true if inserted, false if an existing value was replaced
+    bool insert_or_assign(const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        auto [node, inserted] = insert_with(key, [&]()
+                                            { return val; });
+        if (!inserted)
+            node->value.store(val);
+        return inserted;
+    }
+
+    // returns the value for key, inserting fn(key) if absent. fn is called at most once.
+    template <typename F>
+    V compute_if_absent(const K &key, F fn)
+    {
+        Guard guard(reclaimer);
+        auto [node, inserted] = insert_with(key, [&]()
+                                            { return fn(key); });
+        return node->value.load();
+    }
+
+    // replace the value if key is present
+    bool replace(const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        MNode *right_node = search(key).second;
+        if (!found(right_node, key))
+            return false;
+        right_node->value.store(val);
+        return true;
+    }
+
+    // replace the value if key is present and its value is expected
+    bool replace(const K &key, V expected, const V &desired)
+    {
+        Guard guard(reclaimer);
+        MNode *right_node = search(key).second;
+        if (!found(right_node, key))
+            return false;
+        return right_node->value.compare_exchange_strong(expected, desired);
+    }
+
+    // replace the value with fn(old value) if key is present, retrying the CAS on contention
+    template <typename F>
+    bool update(const K &key, F fn)
+    {
+        Guard guard(reclaimer);
+        MNode *right_node = search(key).second;
+        if (!found(right_node, key))
+            return false;
+        V old_val = right_node->value.load();
+        while (!right_node->value.compare_exchange_weak(old_val, fn(old_val)))
+            ;
+        return true;
+    }
+
+    bool get(const K &key, V &val)
+    {
+        Guard guard(reclaimer);
+        MNode *right_node = search(key).second;
+        if (!found(right_node, key))
+            return false;
+        val = right_node->value.load();
+        return true;
+    }
+
+    bool find(const K &key)
+    {
+        Guard guard(reclaimer);
+        return found(search(key).second, key);
+    }
+
+    bool erase(const K &key)
+    {
+        Guard guard(reclaimer);
+        MNode *right_node, *left_node;
+        MNode *right_node_next;
 
         do
         {
-            Node *t = head;
-            Node *t_next = head->next.load();
+            auto nodes = search(key);
+            left_node = nodes.first;
+            right_node = nodes.second;
 
-            // Find left_node and right_node
-            do
+            if (!found(right_node, key)) // T1
+                return false;
+
+            right_node_next = right_node->next.load();
+            if (!get_mark(right_node_next))
             {
-                if (!get_mark(t_next))
-                {
-                    left_node = t;
-                    left_node_next = t_next;
-                }
-                t = unset_mark(t_next);
-                if (t == tail)
+                if (right_node->next.compare_exchange_strong(
+                        right_node_next, set_mark(right_node_next))) // C3
+                    break;
+            }
+        } while (true); // B4
+
+        if (left_node->next.compare_exchange_strong(right_node, right_node_next)) // C4
+            reclaimer.retire(right_node);
+        else
+            search(key);
+        return true;
+    }
+
+    // caller must hold a guard
+    std::pair<MNode *, MNode *> search(const K &key)
+    {
+        return harris_search(head, tail, key, comp, reclaimer);
+    }
+
+    bool found(MNode *right_node, const K &key)
+    {
+        return (right_node != tail) && !comp(key, right_node->key);
+    }
+
+    // links a node with make_value() unless key is present.
+    // returns the node holding key and whether it is new. caller must hold a guard.
+    template <typename F>
+    std::pair<MNode *, bool> insert_with(const K &key, F make_value)
+    {
+        MNode *new_node = nullptr; // allocated on the first CAS attempt, reused on retries
+        while (true)
+        {
+            auto [left_node, right_node] = search(key);
+            if (found(right_node, key)) // T1
+            {
+                if (new_node != nullptr)
+                    Allocator::destroy(new_node); // never published
+                return {right_node, false};
+            }
+
+            if (new_node == nullptr)
+                new_node = Allocator::create(key, make_value());
+            new_node->next.store(right_node);
+            if (left_node->next.compare_exchange_strong(right_node, new_node)) // C2
+                return {new_node, true};
+        }
+    }
+
+    int size() // not thread-safe
+    {
+        int size = 0;
+        for (MNode *t = unset_mark(head->next.load()); t != tail; t = unset_mark(t->next.load()))
+            size += 1;
+        return size;
+    }
+};
+
+struct SkipNode
+{
+    static const int MAX_LEVEL = 16;
+
+    int key;
+    int top_level;
+    std::atomic<int> finished; // insert done linking, erase done marking. second one retires
+    std::atomic<SkipNode *> next[MAX_LEVEL];
+
+    SkipNode(int k = 0, int top = MAX_LEVEL - 1) : key(k), top_level(top), finished(0)
+    {
+        for (auto &n : next)
+            n.store(nullptr);
+    }
+};
+
+template <typename Reclaimer = EpochReclaimer<SkipNode>>
+struct SkipList
+{
+    // Lock-free skip list (Fraser, Herlihy & Shavit) on the same marked pointers as HarrisList.
+    // Level 0 is a Harris list and holds the set, upper levels are shortcuts into it.
+    // A node is marked top-down, marking level 0 is the LinP of erase.
+    // An inserter may still be linking upper levels of a node that is being erased, so the node
+    // is retired by whichever of insert / erase finishes last, after a search unlinked it everywhere.
+    static const int MAX_LEVEL = SkipNode::MAX_LEVEL;
+    typedef typename Reclaimer::Guard Guard;
+    typedef typename Reclaimer::Allocator Allocator;
+
+    SkipNode *head, *tail;
+    Reclaimer reclaimer;
+
+    SkipList()
+    {
+        head = Allocator::create();
+        tail = Allocator::create();
+        for (auto &n : head->next)
+            n.store(tail);
+    }
+
+    ~SkipList()
+    {
+        SkipNode *t = head;
+        while (t != tail)
+        {
+            SkipNode *tmp = t;
+            t = unset_mark(t->next[0].load());
+            Allocator::destroy(tmp);
+        }
+        Allocator::destroy(tail);
+    }
+
+    static int random_level()
+    {
+        static thread_local std::mt19937 gen(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        int level = 0;
+        unsigned int bits = gen();
+        while (level < MAX_LEVEL - 1 && (bits & 1))
+        {
+            level += 1;
+            bits >>= 1;
+        }
+        return level;
+    }
+
+public:
+    bool insert(int key)
+    {
+        Guard guard(reclaimer);
+        SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        SkipNode *new_node = nullptr; // allocated on the first CAS attempt, reused on retries
+
+        while (true)
+        {
+            if (search(key, preds, succs))
+            {
+                if (new_node != nullptr)
+                    Allocator::destroy(new_node); // never published
+                return false;
+            }
+
+            if (new_node == nullptr)
+                new_node = Allocator::create(key, random_level());
+            for (int level = 0; level <= new_node->top_level; level++)
+                new_node->next[level].store(succs[level]);
+
+            SkipNode *succ = succs[0];
+            if (preds[0]->next[0].compare_exchange_strong(succ, new_node)) // LinP
+                break;
+        }
+
+        // link upper levels, give up once an erase has marked the node
+        bool marked = false;
+        for (int level = 1; level <= new_node->top_level && !marked; level++)
+        {
+            while (true)
+            {
+                SkipNode *succ = succs[level];
+                if (preds[level]->next[level].compare_exchange_strong(succ, new_node))
+                    break;
+
+                search(key, preds, succs);
+                SkipNode *old_next = new_node->next[level].load();
+                if (get_mark(old_next) || !new_node->next[level].compare_exchange_strong(old_next, succs[level]))
                 {
+                    marked = true;
                     break;
                 }
-                t_next = t->next.load();
+            }
+        }
+
+        finish(new_node);
+        return true;
+    }
 
-            } while (get_mark(t_next) || t->key < search_key); // B1
-            right_node = t;
+    bool erase(int key)
+    {
+        Guard guard(reclaimer);
+        SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+
+        if (!search(key, preds, succs))
+            return false;
+        SkipNode *victim = succs[0];
+
+        // mark upper levels, top-down
+        for (int level = victim->top_level; level >= 1; level--)
+        {
+            SkipNode *succ = victim->next[level].load();
+            while (!get_mark(succ))
+                victim->next[level].compare_exchange_weak(succ, set_mark(succ));
+        }
+
+        SkipNode *succ = victim->next[0].load();
+        while (true)
+        {
+            if (get_mark(succ))
+                return false; // someone else erased it
+            if (victim->next[0].compare_exchange_strong(succ, set_mark(succ))) // LinP
+                break;
+        }
+
+        search(key, preds, succs); // unlink
+        finish(victim);
+        return true;
+    }
+
+    bool find(int key)
+    {
+        Guard guard(reclaimer);
+        SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        return search(key, preds, succs);
+    }
 
-            // Check if nodes are adjacent
-            if (left_node_next == right_node)
+    // Read-only find (Herlihy & Shavit), skips marked nodes instead of snipping them
+    bool contains(int key)
+    {
+        Guard guard(reclaimer);
+        SkipNode *pred = head, *curr = tail;
+        for (int level = MAX_LEVEL - 1; level >= 0; level--)
+        {
+            curr = unset_mark(pred->next[level].load());
+            while (curr != tail)
             {
-                if ((right_node != tail) && get_mark(right_node->next.load()))
+                SkipNode *succ = curr->next[level].load();
+                if (get_mark(succ))
                 {
-                    continue; // G1
+                    curr = unset_mark(succ);
+                    continue;
                 }
-                return NodePair(left_node, right_node); // R1
+                if (curr->key >= key)
+                    break;
+                pred = curr;
+                curr = succ;
             }
+        }
+        return (curr != tail) && (curr->key == key); // curr was unmarked on level 0
+    }
 
-            // Remove one or more marked nodes in between
-            Node *_tmp_left_next = unset_mark(left_node_next);
-            bool same_state = left_node->next.compare_exchange_strong(
-                _tmp_left_next, right_node); // C1
-            if (same_state)
+    // insert and erase both end here, the second one retires the node
+    void finish(SkipNode *node)
+    {
+        if (node->finished.fetch_add(1) != 1)
+            return;
+        SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        search(node->key, preds, succs); // nothing links the node anymore, so this unlinks it for good
+        reclaimer.retire(node);
+    }
+
+    // caller must hold a guard
+    // fills preds / succs on every level, snipping marked nodes on the way
+    bool search(int key, SkipNode **preds, SkipNode **succs)
+    {
+        while (true)
+        {
+            if (search_once(key, preds, succs))
+                return (succs[0] != tail) && (succs[0]->key == key);
+        }
+    }
+
+    // false if a snip failed and the search has to restart from head
+    bool search_once(int key, SkipNode **preds, SkipNode **succs)
+    {
+        SkipNode *pred = head;
+        for (int level = MAX_LEVEL - 1; level >= 0; level--)
+        {
+            SkipNode *curr = unset_mark(pred->next[level].load());
+            while (curr != tail)
             {
-                if ((right_node != tail) && get_mark(right_node->next.load()))
+                SkipNode *succ = curr->next[level].load();
+                if (get_mark(succ))
                 {
-                    continue; // G2
+                    // curr is being erased, snip it on this level
+                    SkipNode *expected = curr;
+                    if (!pred->next[level].compare_exchange_strong(expected, unset_mark(succ)))
+                        return false;
+                    curr = unset_mark(succ);
+                    continue;
                 }
-                return NodePair(left_node, right_node); // R2
+                if (curr->key >= key)
+                    break;
+                pred = curr;
+                curr = succ;
             }
-        } while (true); // B2
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return true;
     }
 
-    void print() // not thread-safe
+    int size() // not thread-safe
     {
         int size = 0;
-        std::cout << "--- Printing list: " << std::endl;
-        Node *t = head;
+        SkipNode *t = unset_mark(head->next[0].load());
         while (t != tail)
         {
-            t->print();
             size += 1;
-            t = t->next.load();
+            t = unset_mark(t->next[0].load());
         }
-        std::cout << "--- Size: " << size << std::endl;
-        std::cout << "--- End of list" << std::endl;
+        return size;
+    }
+
+    long long sum() // not thread-safe
+    {
+        long long sum = 0;
+        SkipNode *t = unset_mark(head->next[0].load());
+        while (t != tail)
+        {
+            sum += t->key;
+            t = unset_mark(t->next[0].load());
+        }
+        return sum;
+    }
+};
+
+unsigned reverse_bits(unsigned x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+template <typename Reclaimer = EpochReclaimer<Node>>
+struct SplitOrderedSet
+{
+    // Split-ordered hash set (Shalev & Shavit).
+    // All keys live in one HarrisList sorted by bit-reversed key, and buckets are shortcuts to
+    // sentinel nodes inside it. Doubling the bucket count never moves a key: a new bucket is
+    // spliced in lazily, on first use, as a sentinel between the keys of its parent bucket.
+    // Keys must be non-negative, the top bit tells regular keys (odd) from sentinels (even)
+    // once reversed. Node::key holds the reversed key, shifted so int order is unsigned order.
+    static const unsigned SEGMENT_SIZE = 1024;
+    static const unsigned MAX_BUCKETS = 1u << 22;
+    static const unsigned MAX_SEGMENTS = MAX_BUCKETS / SEGMENT_SIZE;
+
+    typedef std::atomic<Node *> Bucket;
+
+    HarrisList<int, std::less<int>, Reclaimer> list;
+    std::atomic<Bucket *> segments[MAX_SEGMENTS]; // bucket table, allocated a segment at a time
+    std::atomic<unsigned> bucket_count;
+    std::atomic<int> count;
+    int max_load; // average keys per bucket before doubling
+
+    SplitOrderedSet(int max_load = 2, unsigned initial_buckets = 2)
+        : bucket_count(initial_buckets), count(0), max_load(max_load)
+    {
+        assert(initial_buckets > 0 && (initial_buckets & (initial_buckets - 1)) == 0);
+        for (auto &segment : segments)
+            segment.store(nullptr);
+        bucket(0).store(list.head); // head sorts before everything, so it is bucket 0
+    }
+
+    ~SplitOrderedSet()
+    {
+        for (auto &segment : segments)
+            delete[] segment.load();
+    }
+
+    static int split_order(unsigned so_key)
+    {
+        return (int)(so_key ^ 0x80000000u);
+    }
+    static int regular_key(int key)
+    {
+        return split_order(reverse_bits((unsigned)key | 0x80000000u));
+    }
+    static int sentinel_key(unsigned b)
+    {
+        return split_order(reverse_bits(b));
+    }
+
+public:
+    bool insert(int key)
+    {
+        assert(key >= 0);
+        unsigned size = bucket_count.load();
+        Node *start = get_bucket(key & (size - 1));
+        if (!list.insert_from(start, regular_key(key)).second)
+            return false;
+
+        if (count.fetch_add(1) + 1 > (long long)max_load * size && size < MAX_BUCKETS)
+            bucket_count.compare_exchange_strong(size, size * 2); // new buckets fill in lazily
+        return true;
+    }
+
+    bool erase(int key)
+    {
+        assert(key >= 0);
+        Node *start = get_bucket(key & (bucket_count.load() - 1));
+        if (!list.erase_from(start, regular_key(key)))
+            return false;
+        count.fetch_sub(1);
+        return true;
+    }
+
+    bool find(int key)
+    {
+        assert(key >= 0);
+        Node *start = get_bucket(key & (bucket_count.load() - 1));
+        return list.find_from(start, regular_key(key));
+    }
+
+    bool contains(int key)
+    {
+        assert(key >= 0);
+        Node *start = get_bucket(key & (bucket_count.load() - 1));
+        return list.contains_from(start, regular_key(key));
+    }
+
+    Bucket &bucket(unsigned b)
+    {
+        std::atomic<Bucket *> &slot = segments[b / SEGMENT_SIZE];
+        Bucket *segment = slot.load();
+        if (segment == nullptr)
+        {
+            Bucket *fresh = new Bucket[SEGMENT_SIZE];
+            for (unsigned i = 0; i < SEGMENT_SIZE; i++)
+                fresh[i].store(nullptr);
+            if (slot.compare_exchange_strong(segment, fresh))
+                segment = fresh;
+            else
+                delete[] fresh; // someone else installed it
+        }
+        return segment[b % SEGMENT_SIZE];
+    }
+
+    Node *get_bucket(unsigned b)
+    {
+        Node *sentinel = bucket(b).load();
+        if (sentinel == nullptr)
+            sentinel = initialize_bucket(b);
+        return sentinel;
+    }
+
+    Node *initialize_bucket(unsigned b)
+    {
+        // parent is b without its highest bit, its keys are a superset of ours
+        unsigned msb = 1;
+        while (msb <= (b >> 1))
+            msb <<= 1;
+        Node *parent = get_bucket(b ^ msb);
+
+        // racing initializers all get the same sentinel back, sentinels are never erased
+        Node *sentinel = list.insert_from(parent, sentinel_key(b)).first;
+        bucket(b).store(sentinel);
+        return sentinel;
     }
 
     int size() // not thread-safe
     {
         int size = 0;
-        Node *t = head;
-        while (t != tail)
+        for (Node *t = unset_mark(list.head->next.load()); t != list.tail; t = unset_mark(t->next.load()))
         {
-            size += 1;
-            t = t->next.load();
+            if (((unsigned)t->key & 1) != 0) // regular key
+                size += 1;
         }
         return size;
     }
 
-    long long sum()
+    long long sum() // not thread-safe
     {
         long long sum = 0;
-        Node *t = head;
-        while (t != tail)
+        for (Node *t = unset_mark(list.head->next.load()); t != list.tail; t = unset_mark(t->next.load()))
         {
-            sum += t->key;
-            t = t->next.load();
+            unsigned so_key = (unsigned)t->key ^ 0x80000000u;
+            if ((so_key & 1) != 0)
+                sum += reverse_bits(so_key) & 0x7FFFFFFFu;
         }
         return sum;
     }
@@ -276,16 +1061,19 @@ private:
     int mn;
     int mx;
     int iratio;
+    int rratio;
     LinearCongruentialGenerator lcg;
     std::mt19937 mtg;
 
 public:
-    OperationGenerator(int seed, int mn, int mx, int iratio)
+    // iratio : percentage of inserts among updates, rratio : percentage of reads
+    OperationGenerator(int seed, int mn, int mx, int iratio, int rratio = 0)
     {
         this->seed = seed;
         this->mn = mn;
         this->mx = mx;
         this->iratio = iratio;
+        this->rratio = rratio;
         lcg = LinearCongruentialGenerator(A, B, mx - mn, seed);
         mtg = std::mt19937(seed);
     }
@@ -296,6 +1084,11 @@ public:
         // int key = lcg.next() % (mx - mn) + mn;
         int op = mtg() % 100;
         int key = mtg() % (mx - mn) + mn;
+        if (op < rratio)
+        {
+            return Operation(2, key);
+        }
+        op = (op - rratio) * 100 / (100 - rratio);
         if (op < iratio)
         {
             return Operation(0, key);
@@ -307,9 +1100,10 @@ public:
     }
 };
 
-int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int elem_max = -1, bool print = true)
+template <typename List = HarrisList<>>
+int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int elem_max = -1, bool print = true, int read_ratio = 0)
 {
-    HarrisList list;
+    List list;
 
     if (elem_max < 0)
     {
@@ -377,7 +1171,7 @@ int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int
         auto thread_func = [&](int id)
         {
             auto seed = time_seed * 1000 + id;
-            auto gen = OperationGenerator(seed, 10, elem_max, 50);
+            auto gen = OperationGenerator(seed, 10, elem_max, 50, read_ratio);
             int count = ops_count / thread_count;
             int local_size = 0;
             long long local_sum = 0;
@@ -401,7 +1195,7 @@ int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int
                         // std::cout << s << std::endl;
                     }
                 }
-                else
+                else if (op.first == 1)
                 {
                     bool success = list.erase(op.second);
                     if (success)
@@ -412,6 +1206,10 @@ int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int
                         // std::cout << s << std::endl;
                     }
                 }
+                else
+                {
+                    list.contains(op.second);
+                }
             }
 
             size.fetch_add(local_size);
@@ -476,11 +1274,315 @@ int multi_test(int thread_count, int init_size = 100, int ops_count = 1000, int
     return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 }
 
+template <typename Alloc>
+struct CountingAllocator
+{
+    // wraps another allocator and counts created and destroyed nodes
+    static inline std::atomic<long long> created{0}, destroyed{0};
+
+    template <typename... Args>
+    static auto create(Args &&...args)
+    {
+        created.fetch_add(1, std::memory_order_relaxed);
+        return Alloc::create(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    static void destroy(T *node)
+    {
+        destroyed.fetch_add(1, std::memory_order_relaxed);
+        Alloc::destroy(node);
+    }
+};
+
+// Insert only workload on a prefilled list, so all but a few inserts are duplicates.
+// Every insert used to allocate its node up front, so allocations were equal to attempts.
+void duplicate_test(int thread_count, int ops_count, int elem_max)
+{
+    typedef CountingAllocator<NodePool<Node>> Counting;
+    HarrisList<int, std::less<int>, EpochReclaimer<Node, Counting>> list;
+    for (int k = 1; k <= elem_max; k++)
+        list.insert(k);
+
+    long long allocated_start = Counting::created.load();
+    std::atomic<long long> inserted(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            long long local_inserted = 0;
+            for (int i = 0; i < ops_count / thread_count; i++)
+                local_inserted += list.insert(gen() % (2 * elem_max) + 1);
+            inserted.fetch_add(local_inserted); }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    long long attempts = (long long)(ops_count / thread_count) * thread_count;
+    long long allocated = Counting::created.load() - allocated_start;
+    std::cout << "Inserts: " << attempts << ", succeeded: " << inserted.load() << ", duplicates: " << attempts - inserted.load() << std::endl;
+    std::cout << "Allocations: " << allocated << " (eager allocation would be " << attempts << ", saved " << attempts - allocated << ")" << std::endl;
+    std::cout << "Elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+}
+
+// Fill a split-ordered set from a tiny table (growing through every resize) and from a
+// presized one, then run a mixed workload, for a range of load factors.
+void load_factor_test(int thread_count, int elem_max, int ops_count)
+{
+    auto run = [&](SplitOrderedSet<> &set, bool fill)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int id = 0; id < thread_count; id++)
+        {
+            threads.push_back(std::thread([&, id]()
+                                          {
+                if (fill)
+                {
+                    for (int k = id; k < elem_max; k += thread_count)
+                        set.insert(k);
+                    return;
+                }
+                auto gen = OperationGenerator(id, 0, elem_max, 50);
+                for (int i = 0; i < ops_count / thread_count; i++)
+                {
+                    Operation op = gen.next();
+                    if (op.first == 0)
+                        set.insert(op.second);
+                    else
+                        set.erase(op.second);
+                } }));
+        }
+        for (auto &t : threads)
+            t.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    };
+
+    for (int max_load : {1, 2, 4, 8, 16})
+    {
+        unsigned presize = 1;
+        while (presize * max_load < (unsigned)elem_max)
+            presize *= 2;
+
+        SplitOrderedSet<> grown(max_load, 2);
+        long grow_ms = run(grown, true);
+        long mixed_ms = run(grown, false);
+
+        SplitOrderedSet<> presized(max_load, presize);
+        long presized_ms = run(presized, true);
+
+        std::cout << "Load factor " << max_load << " : fill " << grow_ms << "ms (grew to " << grown.bucket_count.load() << " buckets), presized fill " << presized_ms << "ms, mixed " << mixed_ms << "ms" << std::endl;
+    }
+}
+
+// Value updates on a prefilled map: in place vs erase + insert, and a CAS counter increment.
+void update_test(int thread_count, int ops_count, int elem_max)
+{
+    HarrisMap<int, long long> map;
+    for (int k = 1; k <= elem_max; k++)
+        map.insert(k, 0);
+
+    auto run = [&](const std::string &name, auto update)
+    {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int id = 0; id < thread_count; id++)
+        {
+            threads.push_back(std::thread([&, id]()
+                                          {
+                std::mt19937 gen(id);
+                for (int i = 0; i < ops_count / thread_count; i++)
+                    update(gen() % elem_max + 1, i); }));
+        }
+        for (auto &t : threads)
+            t.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << name << " : " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms, size " << map.size() << std::endl;
+    };
+
+    run("insert_or_assign", [&](int key, long long val)
+        { map.insert_or_assign(key, val); });
+    run("erase + insert  ", [&](int key, long long val)
+        { map.erase(key); map.insert(key, val); });
+    run("update increment", [&](int key, long long)
+        { map.update(key, [](long long val)
+                     { return val + 1; }); });
+}
+
+// Sorted batches applied key by key vs through insert_batch / erase_batch
+void batch_test(int thread_count, int batches, int batch_size, int elem_max)
+{
+    auto run = [&](const std::string &name, bool use_batch)
+    {
+        HarrisList<> list;
+        std::atomic<int> size(0);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int id = 0; id < thread_count; id++)
+        {
+            threads.push_back(std::thread([&, id]()
+                                          {
+                std::mt19937 gen(id);
+                std::vector<int> keys(batch_size);
+                for (int b = 0; b < batches / thread_count; b++)
+                {
+                    for (int &key : keys)
+                        key = gen() % elem_max;
+                    std::sort(keys.begin(), keys.end());
+                    bool insert = b % 3 != 2; // grow the list over time
+                    int count = 0;
+                    if (use_batch)
+                        count = insert ? list.insert_batch(keys.begin(), keys.end()) : list.erase_batch(keys.begin(), keys.end());
+                    else
+                        for (int key : keys)
+                            count += insert ? list.insert(key) : list.erase(key);
+                    size += insert ? count : -count;
+                } }));
+        }
+        for (auto &t : threads)
+            t.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        assert(list.size() - 1 == size.load()); // size() counts head
+        std::cout << name << " : " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms, size " << size.load() << std::endl;
+    };
+
+    run("per key", false);
+    run("batch  ", true);
+}
+
+// Same workload with int, 64-bit and 16 byte string keys
+void key_type_test(int thread_count, int ops_count, int elem_max)
+{
+    int trials = 5;
+    int total_int = 0, total_long = 0;
+    for (int i = 0; i < trials; i++)
+    {
+        total_int += multi_test<HarrisList<int>>(thread_count, 100, ops_count, elem_max, false);
+        total_long += multi_test<HarrisList<long long>>(thread_count, 100, ops_count, elem_max, false);
+    }
+
+    typedef FixedKey<16> Key;
+    auto to_key = [](int k)
+    {
+        char buf[17];
+        snprintf(buf, sizeof(buf), "key%010d", k); // zero padded, so byte order is numeric order
+        return Key(buf);
+    };
+    HarrisList<Key> list;
+    std::atomic<int> size(list.size());
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            auto gen = OperationGenerator(id, 10, elem_max, 50);
+            int local_size = 0;
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                Operation op = gen.next();
+                if (op.first == 0)
+                    local_size += list.insert(to_key(op.second));
+                else
+                    local_size -= list.erase(to_key(op.second));
+            }
+            size.fetch_add(local_size); }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    assert(size.load() == list.size());
+    for (auto t = list.head->next.load(); t != list.tail && t->next.load() != list.tail; t = t->next.load())
+        assert(t->key < t->next.load()->key);
+
+    std::cout << "int keys : " << total_int / trials << "ms, 64-bit keys : " << total_long / trials << "ms, 16 byte keys : "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+}
+
+template <typename List>
+struct FindReads : List
+{
+    // routes multi_test reads through find(), which helps unlink, instead of contains()
+    bool contains(int key)
+    {
+        return List::find(key);
+    }
+};
+
+// 95% read workload, reads through find() (helping search) vs contains() (read-only)
+void read_test(int max_threads, int ops_count, int elem_max)
+{
+    for (int ths = 1; ths <= max_threads; ths *= 2)
+    {
+        int trials = 5;
+        int total_find = 0, total_contains = 0;
+        for (int i = 0; i < trials; i++)
+        {
+            total_find += multi_test<FindReads<HarrisList<>>>(ths, elem_max / 2, ops_count, elem_max, false, 95);
+            total_contains += multi_test<HarrisList<>>(ths, elem_max / 2, ops_count, elem_max, false, 95);
+        }
+        std::cout << ths << " threads, find : " << total_find / trials << "ms, contains : " << total_contains / trials << "ms" << std::endl;
+    }
+}
+
+long rss_kb()
+{
+    // resident set size from /proc (linux only)
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Sustained insert/erase churn on a small key range.
+// Reports throughput and how much RSS grew while churning.
+template <typename List>
+void churn_test(const std::string &name, int thread_count, int rounds, int ops_per_round, int elem_max)
+{
+    List list;
+    for (int k = 1; k <= elem_max; k += 2)
+        list.insert(k);
+
+    long rss_start = rss_kb();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<std::thread> threads;
+        for (int id = 0; id < thread_count; id++)
+        {
+            threads.push_back(std::thread([&, id]()
+                                          {
+                auto gen = OperationGenerator(r * 1000 + id, 1, elem_max, 50);
+                for (int i = 0; i < ops_per_round / thread_count; i++)
+                {
+                    Operation op = gen.next();
+                    if (op.first == 0)
+                        list.insert(op.second);
+                    else
+                        list.erase(op.second);
+                } }));
+        }
+        for (auto &t : threads)
+            t.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    long long ops = (long long)rounds * ops_per_round;
+
+    std::cout << name << " : " << ms << "ms, " << ops / (ms + 1) << " ops/ms, RSS growth " << (rss_kb() - rss_start) << "KB" << std::endl;
+}
+
 int main()
 {
     Node *test = new Node(5);
     test->debug_info();
     delete test;
+    ListNode<long long>().debug_info();
+    ListNode<FixedKey<16>>().debug_info();
     // assert(false);
 
     // Test 0
@@ -492,34 +1594,137 @@ int main()
     // Test 3
     multi_test(8, 10000, 50000, 10000);
 
+    // Same tests on the skip list
+    multi_test<SkipList<>>(2, 100, 500, 500);
+    multi_test<SkipList<>>(8, 100, 200, 500);
+    multi_test<SkipList<>>(8, 100, 5000, 500);
+    multi_test<SkipList<>>(8, 10000, 50000, 10000);
+
+    // Same tests on the split-ordered hash set
+    multi_test<SplitOrderedSet<>>(2, 100, 500, 500);
+    multi_test<SplitOrderedSet<>>(8, 100, 200, 500);
+    multi_test<SplitOrderedSet<>>(8, 100, 5000, 500);
+    multi_test<SplitOrderedSet<>>(8, 10000, 50000, 10000);
+
+    {
+        // a guard nested in another must keep the outer one's epoch pinned when it exits
+        typedef CountingAllocator<NodePool<Node>> Counting;
+        typedef EpochReclaimer<Node, Counting> Reclaimer;
+        Reclaimer reclaimer;
+        long long destroyed = Counting::destroyed.load();
+        {
+            Reclaimer::Guard outer(reclaimer);
+            {
+                Reclaimer::Guard inner(reclaimer);
+            }
+            reclaimer.retire(Counting::create(1));
+            std::thread([&]()
+                        {
+                for (int i = 0; i < 10 * Reclaimer::ADVANCE_INTERVAL; i++)
+                {
+                    Reclaimer::Guard g(reclaimer);
+                    reclaimer.retire(Counting::create(2));
+                } })
+                .join();
+            assert(Counting::destroyed.load() == destroyed);
+        }
+    }
+
+    // Reclamation: leak everything vs epoch based
+    std::cout << " --- Churn test --- " << std::endl;
+    churn_test<HarrisList<int, std::less<int>, LeakReclaimer<Node>>>("leak ", 8, 20, 200000, 1000);
+    churn_test<HarrisList<int, std::less<int>, EpochReclaimer<Node>>>("epoch", 8, 20, 200000, 1000);
+    std::cout << " --- End of churn test --- " << std::endl
+              << std::endl;
+
+    // Split-ordered hash set: load factor and resizing
+    std::cout << " --- Load factor test --- " << std::endl;
+    load_factor_test(8, 1000000, 2000000);
+    std::cout << " --- End of load factor test --- " << std::endl
+              << std::endl;
+
+    // Map value updates
+    std::cout << " --- Update test --- " << std::endl;
+    update_test(8, 200000, 1000);
+    std::cout << " --- End of update test --- " << std::endl
+              << std::endl;
+
+    // Key types
+    std::cout << " --- Key type test --- " << std::endl;
+    key_type_test(8, 50000, 10000);
+    std::cout << " --- End of key type test --- " << std::endl
+              << std::endl;
+
+    // Read mostly
+    std::cout << " --- Read test --- " << std::endl;
+    read_test(16, 50000, 10000);
+    std::cout << " --- End of read test --- " << std::endl
+              << std::endl;
+
+    // Sorted bulk updates
+    std::cout << " --- Batch test --- " << std::endl;
+    for (int ths : {1, 4})
+    {
+        std::cout << ths << " threads" << std::endl;
+        batch_test(ths, 48, 1000, 100000);
+    }
+    std::cout << " --- End of batch test --- " << std::endl
+              << std::endl;
+
+    // Duplicate inserts should not allocate
+    std::cout << " --- Duplicate insert test --- " << std::endl;
+    duplicate_test(8, 200000, 1000);
+    std::cout << " --- End of duplicate insert test --- " << std::endl
+              << std::endl;
+
+    // Allocation: global new vs thread local node pool, on a short list so writes dominate
+    std::cout << " --- Allocator test --- " << std::endl;
+    for (int ths : {1, 4, 8, 16})
+    {
+        int trials = 10;
+        int total_new = 0, total_pool = 0;
+        for (int i = 0; i < trials; i++)
+        {
+            total_new += multi_test<HarrisList<int, std::less<int>, EpochReclaimer<Node, NewAllocator<Node>>>>(ths, 100, 200000, 200, false);
+            total_pool += multi_test<HarrisList<int, std::less<int>, EpochReclaimer<Node, NodePool<Node>>>>(ths, 100, 200000, 200, false);
+        }
+        std::cout << ths << " threads, new : " << total_new / trials << "ms, pool : " << total_pool / trials << "ms" << std::endl;
+    }
+    std::cout << " --- End of allocator test --- " << std::endl
+              << std::endl;
+
     int MAX_THREADS = 10;
 
     int timings[16];
+    int skip_timings[16];
 
     for (int ths = 1; ths <= MAX_THREADS; ths++)
     {
 
         int trials = 20;
-        int total = 0;
+        int total = 0, skip_total = 0;
         for (int i = 0; i < trials; i++)
         {
             int ms = multi_test(ths, 100, 50000, 10000, false);
+            int skip_ms = multi_test<SkipList<>>(ths, 100, 50000, 10000, false);
             total += ms;
-            std::cout << "Trial " << i << " : " << ms << "ms" << std::endl;
+            skip_total += skip_ms;
+            std::cout << "Trial " << i << " : " << ms << "ms, skip list " << skip_ms << "ms" << std::endl;
         }
-        std::cout << "Average of " << ths << " threads :" << total / trials << "ms" << std::endl;
+        std::cout << "Average of " << ths << " threads :" << total / trials << "ms, skip list " << skip_total / trials << "ms" << std::endl;
         timings[ths] = total / trials;
+        skip_timings[ths] = skip_total / trials;
     }
 
     std::cout << "Timings: ";
     for (int i = 1; i <= MAX_THREADS; i++)
     {
-        std::cout << "Average time for " << i << " threads: " << timings[i] << "ms\n";
+        std::cout << "Average time for " << i << " threads: " << timings[i] << "ms, skip list " << skip_timings[i] << "ms\n";
     }
 
     return 0;
 
-    HarrisList list;
+    HarrisList<> list;
 
     // Basic Tests for insert, erase and find
 
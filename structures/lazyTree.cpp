@@ -9,190 +9,1017 @@
 #include <vector>
 #include <chrono>
 #include <string>
-#include <mutex>
 #include <queue>
+#include <map>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <mutex>
+#include <numeric>
+
+#include "epochReclaimer.h"
+#include "nodePool.h"
+#include "spinLock.h"
+
+// Aggregates the tree keeps over the values in each key range : a commutative monoid
+// (identity() and combine()), and lift() for a single value.
+// Invertible ones also have inverse(), so a remove is applied on the way down like an
+// insert is. additive ones combine with +, and nodes take them with a fetch_add.
+// Values are 64-bit. Sum<> adds them in 64 bits, Sum<__int128> cannot overflow.
+
+template <typename T = long long>
+struct Sum
+{
+    typedef T Value;
+    static const bool invertible = true, additive = true;
+    static T identity() { return 0; }
+    static T lift(long long value) { return value; }
+    static T combine(T a, T b) { return a + b; }
+    static T inverse(T a) { return -a; }
+};
+
+struct Count
+{
+    typedef int Value;
+    static const bool invertible = true, additive = true;
+    static int identity() { return 0; }
+    static int lift(long long) { return 1; }
+    static int combine(int a, int b) { return a + b; }
+    static int inverse(int a) { return -a; }
+};
+
+template <typename T = long long>
+struct SumOfSquares
+{
+    typedef T Value;
+    static const bool invertible = true, additive = true;
+    static T identity() { return 0; }
+    static T lift(long long value) { return (T)value * value; }
+    static T combine(T a, T b) { return a + b; }
+    static T inverse(T a) { return -a; }
+};
+
+// Min and Max cannot take a value back out. A remove marks the nodes it goes through
+// dirty instead, and the next query that needs one of them whole recomputes it from below.
+// reaches() tells whether a subtree may hold a value at threshold or past it, for
+// first_reaching().
+
+template <typename T = long long>
+struct Min
+{
+    typedef T Value;
+    static const bool invertible = false, additive = false;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    static T lift(long long value) { return value; }
+    static T combine(T a, T b) { return std::min(a, b); }
+    static bool reaches(T agg, T threshold) { return agg <= threshold; }
+};
+
+template <typename T = long long>
+struct Max
+{
+    typedef T Value;
+    static const bool invertible = false, additive = false;
+    static T identity() { return std::numeric_limits<T>::min(); }
+    static T lift(long long value) { return value; }
+    static T combine(T a, T b) { return std::max(a, b); }
+    static bool reaches(T agg, T threshold) { return agg >= threshold; }
+};
+
+// 16 byte atomic integer, for Sum<__int128>. std::atomic<__int128> needs libatomic (and
+// does not say it is lock-free), so on x86-64 this is a lock cmpxchg16b loop.
+// A compare exchange that does not change the value also reads atomically, but it writes the
+// line all the same : every load takes it exclusive, and readers of a node's sum (all of
+// them, at the top of the tree) contend with each other as much as writers do. Processors
+// with AVX do aligned 16 byte SSE loads atomically (Intel and AMD both document it), so
+// there load() is a plain movdqa, checked once at startup. cmpxchg16b is the fallback.
+struct alignas(16) AtomicInt128
+{
+    __int128 value;
+#if defined(__x86_64__)
+    static inline const bool sse_loads = (__builtin_cpu_init(), __builtin_cpu_supports("avx"));
+#endif
+
+    AtomicInt128(__int128 v = 0) : value(v) {}
 
+    bool compare_exchange_weak(__int128 &expected, __int128 desired)
+    {
+#if defined(__x86_64__)
+        bool ok;
+        unsigned long long lo = (unsigned long long)expected, hi = (unsigned long long)((unsigned __int128)expected >> 64);
+        asm volatile("lock cmpxchg16b %1"
+                     : "=@ccz"(ok), "+m"(value), "+a"(lo), "+d"(hi)
+                     : "b"((unsigned long long)desired), "c"((unsigned long long)((unsigned __int128)desired >> 64))
+                     : "memory");
+        expected = (__int128)(((unsigned __int128)hi << 64) | lo);
+        return ok;
+#else
+        return __atomic_compare_exchange_n(&value, &expected, desired, true, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+    }
+
+    __int128 load()
+    {
+#if defined(__x86_64__)
+        if (sse_loads)
+        {
+            // a plain x86 load is already sequentially consistent (the locked writes carry
+            // the fence), the clobber keeps the compiler from moving it
+            typedef long long Pair __attribute__((vector_size(16)));
+            Pair v;
+            asm volatile("movdqa %1, %0"
+                         : "=x"(v)
+                         : "m"(value)
+                         : "memory");
+            return (__int128)(((unsigned __int128)(unsigned long long)v[1] << 64) | (unsigned long long)v[0]);
+        }
+#endif
+        __int128 v = 0;
+        compare_exchange_weak(v, 0);
+        return v;
+    }
+
+    void store(__int128 v)
+    {
+        __int128 old = load();
+        while (!compare_exchange_weak(old, v))
+            ;
+    }
+
+    __int128 fetch_add(__int128 d)
+    {
+        __int128 old = load();
+        while (!compare_exchange_weak(old, old + d))
+            ;
+        return old;
+    }
+};
+
+// atomic type for the aggregates of a tree
+template <typename T>
+struct AtomicOf
+{
+    typedef std::atomic<T> type;
+};
+
+template <>
+struct AtomicOf<__int128>
+{
+    typedef AtomicInt128 type;
+};
+
+template <typename Agg>
 struct Node;
-typedef std::atomic<Node *> Edge;
-typedef std::tuple<int, int, int> Operation; // key, value, type
+template <typename Agg>
+using Edge = std::atomic<Node<Agg> *>;
 
+struct Operation
+{
+    int key, type; // type 1 for insert, -1 for remove, 0 only dirties the path (not invertible)
+    long long value;
+    Operation *next;
+};
+
+// Locks are one byte SpinLocks.
+// Pending operations are an intrusive lock-free list per node. Writers push with a CAS on
+// the head, and propagate() takes the whole list with one exchange, so there is no lock on
+// the write path and no ABA (nothing is ever popped alone). Operations are not ordered,
+// aggregates do not need it. A propagated operation is relinked into the child's list as
+// is, it is allocated once per write and freed when it reaches a leaf.
+//
+// The aggregate of a node counts every operation that was pushed to it, including the ones
+// still pending there. Operations only move down, by key, so this stays right as long as the
+// key range of a node never changes. Hence removed leaves stay in the tree (flagged removed)
+// and are revived by the next insert of their key, and the only structural change on the
+// write path is an insert splitting a leaf, whose aggregate moves to the new internal node.
+// compact() takes removed leaves out once no operation of their key is left on the way.
+//
+// Aggregates without an inverse are plain values under the node's lock, which push() and
+// propagate() take (see recompute()).
+template <typename Agg>
 struct Node
 {
-    std::atomic<bool> removed;
-    std::mutex tree_mtx;
+    typedef typename Agg::Value Value;
 
-    std::atomic<int> sum;
-    std::queue<Operation> op_queue;
-    std::mutex op_mutex;
+    std::atomic<bool> removed; // leaf : key removed, internal : unlinked by compact()
+    SpinLock tree_mtx;         // internal : child pointers, leaf : removed, value, agg, parent and inflight
+    bool is_leaf;
+    bool dirty;                // not invertible : a remove went through since agg was computed
+    std::atomic<bool> queued; // in the workers' queue
 
+    std::conditional_t<Agg::invertible, typename AtomicOf<Value>::type, Value> agg;
     int key;
-    bool is_leaf;
+    std::atomic<int> pending;     // length of ops
+    std::atomic<Operation *> ops; // pending, newest first
 
-    Node(int k = -1, bool is_leaf = false) : key(k), is_leaf(is_leaf), removed(false) {}
+    Node(int k = -1, bool is_leaf = false) : removed(false), is_leaf(is_leaf), dirty(false), queued(false), agg(Agg::identity()), key(k), pending(0), ops(nullptr) {}
 };
 
-struct LeafNode : Node
+template <typename Agg>
+struct InternalNode;
+
+template <typename Agg>
+struct LeafNode : Node<Agg>
 {
-    int value;
-    LeafNode(int k, int v) : Node(k, true), value(v) {}
+    long long value;
+    InternalNode<Agg> *parent; // operations from any other node arrived through a stale pointer,
+                               // nullptr once compact() unlinked the leaf
+    int inflight = 0;          // operations on key pushed to the root that have not arrived yet
+    LeafNode(int k, long long v, InternalNode<Agg> *parent = nullptr) : Node<Agg>(k, true), value(v), parent(parent) {}
 };
 
-struct InternalNode : Node
+template <typename Agg>
+struct InternalNode : Node<Agg>
 {
-    Edge child[2]; // [~, key), [key, ~)
-    InternalNode(int k = -1, Node *l = nullptr, Node *r = nullptr) : Node(k, false)
+    Edge<Agg> child[2]; // [~, key), [key, ~)
+    InternalNode(int k = -1, Node<Agg> *l = nullptr, Node<Agg> *r = nullptr) : Node<Agg>(k, false)
     {
         child[0].store(l);
         child[1].store(r);
     }
 };
 
+// nodes are plain new / delete, for the EpochReclaimer that frees the ones compact() unlinks
+struct NodeDeleter
+{
+    template <typename N>
+    static void destroy(N *nd)
+    {
+        delete nd;
+    }
+};
+
 // make it work in serial setting
-// maintaining min-max for returning early?
 
+template <typename Agg = Sum<>>
 struct LeafTree
 {
+    typedef ::Node<Agg> Node;
+    typedef ::LeafNode<Agg> LeafNode;
+    typedef ::InternalNode<Agg> InternalNode;
+    typedef typename Agg::Value Value;
+    typedef EpochReclaimer<Node, NodeDeleter> Reclaimer;
+    typedef typename Reclaimer::Guard Guard;
+
     const int MAX_KEY = 2147483647;
     InternalNode *root; // root will only have left child.
-    LeafTree() : root(new InternalNode(MAX_KEY)) {}
+    // Writers propagate a node once it holds buffer_limit pending operations, then its
+    // children that fill up in turn (buffer tree style). Each operation moves down one level
+    // at a time, so the cost is amortized over the writes, and what sum() finds pending is
+    // bounded. With 0, operations wait for sum().
+    const int buffer_limit;
+    // Propagation and snapshot reads exclude each other, any number of either can run at
+    // once (see snapshot_sum()). Writers skip their flush while a snapshot reads.
+    std::atomic<int> propagators{0}, snapshots{0};
+    // compact() keeps both out while it runs, see there
+    std::atomic<bool> compacting{false};
+    // live leaves << 32 | removed ones, one atomic so a write updates both at once
+    static const long long LIVE = 1LL << 32, REMOVED_MASK = LIVE - 1;
+    static const long long MIN_COMPACT = 64;
+    std::atomic<long long> leaf_counts{0};
+    std::atomic<long long> compact_at{0}; // twice what compact() left removed
+    // Every operation runs inside a guard, so what compact() unlinks is freed once no one
+    // can be on it (workers hold the node they popped, sum_batch() threads are covered by
+    // the caller's guard)
+    Reclaimer reclaimer;
+    // Background propagation, see work()
+    std::vector<std::thread> workers;
+    std::atomic<bool> stopping{false};
+    std::mutex work_mtx;
+    std::priority_queue<std::pair<int, InternalNode *>> work_queue; // pending when queued, node
+
+    // sentinel leaf with MAX_KEY, so every insert splits a leaf
+    LeafTree(int buffer_limit = 64, int worker_count = 0) : root(new InternalNode(MAX_KEY)), buffer_limit(buffer_limit)
+    {
+        root->child[0].store(new LeafNode(MAX_KEY, 0, root));
+        for (int i = 0; i < worker_count; i++)
+            workers.push_back(std::thread(&LeafTree::work, this));
+    }
+
+    ~LeafTree()
+    {
+        stopping.store(true);
+        for (auto &t : workers)
+            t.join();
+        // the nodes still in the tree and the operations pending in them, the reclaimer
+        // frees the unlinked ones
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            Operation *op = nd->ops.load();
+            while (op != nullptr)
+            {
+                Operation *next = op->next;
+                NodePool<Operation>::destroy(op);
+                op = next;
+            }
+            if (nd->is_leaf)
+            {
+                delete (LeafNode *)nd;
+                continue;
+            }
+            for (auto &c : ((InternalNode *)nd)->child)
+                if (c.load() != nullptr)
+                    stack.push_back(c.load());
+            delete (InternalNode *)nd;
+        }
+    }
+
+    static void debug_info()
+    {
+        std::cout << " --- Node Debug Info ---" << std::endl;
+        std::cout << "Leaf node size : " << sizeof(LeafNode) << std::endl;
+        std::cout << "Internal node size : " << sizeof(InternalNode) << std::endl;
+        std::cout << std::endl;
+        std::cout << "Node lock size : " << sizeof(SpinLock) << std::endl;
+        std::cout << "Operation size : " << sizeof(Operation) << ", pool block " << NodePool<Operation>::BLOCK_SIZE << std::endl;
+        std::cout << " --- End of Node Debug Info ---" << std::endl
+                  << std::endl;
+    }
+
+    // what op adds to an aggregate, for invertible ones
+    static Value delta(const Operation *op)
+    {
+        if constexpr (Agg::additive)
+            return Agg::lift(op->value) * op->type;
+        else
+            return op->type > 0 ? Agg::lift(op->value) : Agg::inverse(Agg::lift(op->value));
+    }
+
+    // add op to the aggregate of nd and its pending list
+    void push(Node *nd, Operation *op)
+    {
+        if constexpr (Agg::additive)
+            nd->agg.fetch_add(delta(op));
+        else if constexpr (Agg::invertible)
+        {
+            Value old = nd->agg.load();
+            while (!nd->agg.compare_exchange_weak(old, Agg::combine(old, delta(op))))
+                ;
+        }
+        else
+        {
+            nd->tree_mtx.lock();
+            if (op->type > 0)
+                nd->agg = Agg::combine(nd->agg, Agg::lift(op->value));
+            else
+                nd->dirty = true;
+        }
+        nd->pending.fetch_add(1, std::memory_order_relaxed);
+        Operation *head = nd->ops.load(std::memory_order_relaxed);
+        do
+            op->next = head;
+        while (!nd->ops.compare_exchange_weak(head, op, std::memory_order_release, std::memory_order_relaxed));
+        if constexpr (!Agg::invertible)
+            nd->tree_mtx.unlock();
+    }
+
+    // add op to the aggregate of leaf, unless leaf was split since it was read from parent
+    bool deliver(LeafNode *leaf, InternalNode *parent, Operation *op)
+    {
+        leaf->tree_mtx.lock();
+        bool ok = leaf->parent == parent;
+        if (ok)
+        {
+            if (op->type != 0)
+                leaf->inflight--;
+            if constexpr (Agg::invertible)
+                leaf->agg.fetch_add(delta(op));
+            else // operations on one key arrive in any order, the leaf itself knows the last
+                leaf->agg = leaf->removed.load() ? Agg::identity() : Agg::lift(leaf->value);
+        }
+        leaf->tree_mtx.unlock();
+        return ok;
+    }
 
     void propagate(InternalNode *nd)
     {
         // propagate one level
-        // assume all locks are acquired properly
-        while (!nd->op_queue.empty())
+        // concurrent calls are fine, each one takes a disjoint part of the list
+        // (a plain load first, so queries do not write to nodes with nothing pending)
+        if (nd->ops.load(std::memory_order_relaxed) == nullptr)
+            return;
+        if constexpr (Agg::invertible)
+            propagate_list(nd);
+        else
         {
-            auto [key, val, type] = nd->op_queue.front();
-            nd->op_queue.pop();
-            int dir = nd->key <= key;
-            Node *child = nd->child[dir].load();
-            if (child == nullptr)
-                continue; // can this happen?
+            nd->tree_mtx.lock();
+            propagate_list(nd);
+            nd->tree_mtx.unlock();
+        }
+    }
 
-            child->op_mutex.lock();
-            child->op_queue.push({key, val, type});
-            child->sum.fetch_add(val * type);
-            child->op_mutex.unlock();
+    void propagate_list(InternalNode *nd)
+    {
+        Operation *op = nd->ops.exchange(nullptr, std::memory_order_acquire);
+        int count = 0;
+        while (op != nullptr)
+        {
+            if (Agg::invertible && snapshots.load(std::memory_order_relaxed) > 0 && !compacting.load())
+            {
+                // a snapshot waits for this, the rest goes back to nd (which still counts it).
+                // Snapshots back off while compact() runs, which needs everything propagated.
+                Operation *last = op;
+                while (last->next != nullptr)
+                    last = last->next;
+                Operation *head = nd->ops.load(std::memory_order_relaxed);
+                do
+                    last->next = head;
+                while (!nd->ops.compare_exchange_weak(head, op, std::memory_order_release, std::memory_order_relaxed));
+                break;
+            }
+            Operation *next = op->next;
+            int dir = nd->key <= op->key;
+            while (true)
+            {
+                Node *child = nd->child[dir].load();
+                if (!child->is_leaf)
+                {
+                    push(child, op);
+                    break;
+                }
+                // leaves only keep the aggregate
+                if (deliver((LeafNode *)child, nd, op))
+                {
+                    NodePool<Operation>::destroy(op);
+                    break;
+                }
+            }
+            op = next;
+            count += 1;
         }
+        nd->pending.fetch_sub(count, std::memory_order_relaxed);
+    }
+
+    // aggregate of the whole subtree of nd
+    Value subtree(Node *nd)
+    {
+        if (nd == nullptr)
+            return Agg::identity();
+        if constexpr (Agg::invertible)
+            return nd->agg.load();
+        else
+        {
+            nd->tree_mtx.lock();
+            if (nd->dirty)
+                return recompute((InternalNode *)nd);
+            Value agg = nd->agg;
+            nd->tree_mtx.unlock();
+            return agg;
+        }
+    }
+
+    // For aggregates without an inverse : recomputes the locked, dirty top from its
+    // children, and those from theirs where they are dirty too, then unlocks it.
+    // Only a node's own lock moves operations out of it, so once a locked node is propagated
+    // its children hold all it had. The dirty nodes are locked and propagated top down, the
+    // same order as everywhere else, and computed bottom up.
+    Value recompute(InternalNode *top)
+    {
+        struct Frame
+        {
+            InternalNode *nd;
+            bool held[2]; // child is a dirty frame further on, locked by us
+        };
+        std::vector<Frame> frames = {{top, {false, false}}};
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            InternalNode *nd = frames[i].nd;
+            propagate_list(nd);
+            for (int dir = 0; dir < 2; dir++)
+            {
+                Node *child = nd->child[dir].load();
+                if (child == nullptr || child->is_leaf)
+                    continue;
+                child->tree_mtx.lock();
+                if (child->dirty)
+                {
+                    frames[i].held[dir] = true;
+                    frames.push_back({(InternalNode *)child, {false, false}});
+                }
+                else
+                    child->tree_mtx.unlock();
+            }
+        }
+
+        for (size_t i = frames.size(); i-- > 0;)
+        {
+            InternalNode *nd = frames[i].nd;
+            Value agg = Agg::identity();
+            for (int dir = 0; dir < 2; dir++)
+            {
+                Node *child = nd->child[dir].load();
+                if (child == nullptr)
+                    continue;
+                if (!frames[i].held[dir])
+                    child->tree_mtx.lock();
+                agg = Agg::combine(agg, child->agg);
+                if (!frames[i].held[dir])
+                    child->tree_mtx.unlock();
+            }
+            nd->agg = agg;
+            nd->dirty = false;
+        }
+
+        Value agg = top->agg;
+        for (auto &frame : frames)
+            frame.nd->tree_mtx.unlock();
+        return agg;
+    }
+
+    bool try_enter_propagation()
+    {
+        propagators.fetch_add(1);
+        if (snapshots.load() == 0 && !compacting.load())
+            return true;
+        propagators.fetch_sub(1);
+        return false;
+    }
+
+    void enter_propagation()
+    {
+        Backoff backoff;
+        while (!try_enter_propagation())
+            backoff.pause();
+    }
+
+    void exit_propagation()
+    {
+        propagators.fetch_sub(1);
+    }
+
+    // waits for running propagations, and keeps new ones out until exit_snapshot()
+    void enter_snapshot()
+    {
+        Backoff backoff;
+        while (true)
+        {
+            snapshots.fetch_add(1);
+            if (!compacting.load())
+                break;
+            snapshots.fetch_sub(1);
+            backoff.pause();
+        }
+        while (propagators.load() > 0)
+            backoff.pause();
+    }
+
+    void exit_snapshot()
+    {
+        snapshots.fetch_sub(1);
+    }
+
+    // Worker thread : propagates the queued node with the most pending operations, then
+    // queues its children that have some, so the work goes top down and biggest backlog
+    // first. With nothing queued it starts over from the root, or sleeps if the root has
+    // nothing pending either. Like flush(), it stays out of the way of snapshots.
+    void work()
+    {
+        while (!stopping.load(std::memory_order_relaxed))
+        {
+            bool idle;
+            {
+                Guard guard(reclaimer); // the node we pop stays allocated if compact() unlinks it
+                idle = !work_step();
+            }
+            if (idle)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    // false if there was nothing to do
+    bool work_step()
+    {
+        InternalNode *nd = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(work_mtx);
+            if (!work_queue.empty())
+            {
+                nd = work_queue.top().second;
+                work_queue.pop();
+                nd->queued.store(false, std::memory_order_relaxed);
+            }
+        }
+        if (nd == nullptr)
+        {
+            if (root->pending.load(std::memory_order_relaxed) == 0)
+                return false;
+            nd = root;
+        }
+        if (!try_enter_propagation())
+        {
+            queue_work(nd);
+            std::this_thread::yield();
+            return true;
+        }
+        propagate(nd);
+        exit_propagation();
+        for (auto &c : nd->child)
+        {
+            Node *child = c.load();
+            if (child != nullptr && !child->is_leaf && child->pending.load(std::memory_order_relaxed) > 0)
+                queue_work((InternalNode *)child);
+        }
+        return true;
+    }
+
+    void queue_work(InternalNode *nd)
+    {
+        if (nd->queued.load(std::memory_order_relaxed))
+            return;
+        std::lock_guard<std::mutex> lock(work_mtx);
+        // compact() only unlinks nodes that are not queued, and flags them under work_mtx
+        if (nd->queued.load(std::memory_order_relaxed) || nd->removed.load())
+            return;
+        nd->queued.store(true, std::memory_order_relaxed);
+        work_queue.push({nd->pending.load(std::memory_order_relaxed), nd});
+    }
+
+    // write path : propagate nd if it is over the limit, then its children that go over it
+    void flush(InternalNode *nd)
+    {
+        if (buffer_limit <= 0 || nd->pending.load(std::memory_order_relaxed) < buffer_limit)
+            return;
+        if (!try_enter_propagation())
+            return; // a snapshot is reading, the next write flushes
+        std::vector<InternalNode *> stack = {nd};
+        // a snapshot waiting for this stops it after the current node
+        while (!stack.empty() && snapshots.load(std::memory_order_relaxed) == 0)
+        {
+            nd = stack.back();
+            stack.pop_back();
+            propagate(nd);
+            for (auto &c : nd->child)
+            {
+                Node *child = c.load();
+                if (child != nullptr && !child->is_leaf && child->pending.load(std::memory_order_relaxed) >= buffer_limit)
+                    stack.push_back((InternalNode *)child);
+            }
+        }
+        exit_propagation();
     }
 
     auto find(InternalNode *root, int key)
     {
         // does not propagate operations
         // for insert & remove
-        InternalNode *gp = nullptr;
-        int gp_dir = 1;
         InternalNode *p = root;
         int p_dir = 0;
         Node *l = p->child[p_dir].load();
 
         while (!l->is_leaf)
         {
-            gp = p;
-            gp_dir = p_dir;
             p = (InternalNode *)l;
             p_dir = p->key <= key ? 1 : 0;
             l = p->child[p_dir].load();
         }
 
-        return std::make_tuple(gp, gp_dir, p, p_dir, (LeafNode *)l);
+        return std::make_tuple(p, p_dir, (LeafNode *)l);
     }
 
-    bool insert(InternalNode *root, int key, int val)
+    // Writes push their operation to the root under the leaf lock of their key, so the root
+    // gets the writes of a key in order (snapshot_sum() needs it). The push is their
+    // linearization point, and comes before search() can see the write (the removed flag, or
+    // the link to a new leaf), so a snapshot_sum() after a search() never misses what it saw.
+    // Without an inverse, push() locks the root, which must not nest in a leaf lock : those
+    // push after unlocking, and linearize where search() sees them.
+    void push_write(InternalNode *root, int key, int type, long long val, bool leaf_locked)
     {
-        // TODO
+        if (leaf_locked == Agg::invertible)
+            push(root, NodePool<Operation>::create(Operation{key, type, val, nullptr}));
+    }
+
+    // keys must be below MAX_KEY, the sentinel's key
+    bool insert(InternalNode *root, int key, long long val)
+    {
+        if (key >= MAX_KEY)
+            return false;
+        Guard guard(reclaimer);
+        LeafNode *written; // the leaf now holding key
         while (true)
         {
-            auto [gp, gp_dir, p, p_dir, leaf] = find(root, key);
+            auto [p, p_dir, leaf] = find(root, key);
             if (leaf->key == key)
-                return false;
+            {
+                // revive
+                leaf->tree_mtx.lock();
+                if (leaf->parent == nullptr)
+                {
+                    // compacted away
+                    leaf->tree_mtx.unlock();
+                    continue;
+                }
+                bool revived = leaf->removed.load();
+                if (revived)
+                {
+                    leaf->value = val;
+                    leaf->inflight++;
+                    push_write(root, key, 1, val, true); // LinP for success
+                    leaf->removed.store(false);          // LinP for success without an inverse
+                    leaf_counts.fetch_add(LIVE - 1);
+                }
+                leaf->tree_mtx.unlock();
+                if (!revived)
+                    return false;
+                written = leaf;
+                break;
+            }
 
             p->tree_mtx.lock();
-            Edge *ptr = &(p->child[p_dir]); // desired location
+            Edge<Agg> *ptr = &(p->child[p_dir]); // desired location
             if (p->removed.load() || ptr->load() != leaf)
             {
-                // p updated
+                // p updated, or compacted away
                 p->tree_mtx.unlock();
                 continue;
             }
 
+            leaf->tree_mtx.lock();
             LeafNode *new_leaf_node = new LeafNode(key, val);
             InternalNode *new_in_node =
                 (leaf->key < key)
                     ? new InternalNode(key, leaf, new_leaf_node)
                     : new InternalNode(leaf->key, new_leaf_node, leaf);
-            root->op_mutex.lock();
-            root->op_queue.push({key, val, 1});
-            root->sum.fetch_add(val);
-            root->op_mutex.unlock();
-            // check size of root and propagate (just before return) if full
-            ptr->store(new_in_node);
-
+            // the leaf's operations so far are now counted by new_in_node, later ones come
+            // through it (deliver() turns away the ones still on their way from p)
+            if constexpr (Agg::invertible)
+                new_in_node->agg.store(leaf->agg.load());
+            else
+                new_in_node->agg = leaf->agg;
+            new_leaf_node->parent = new_in_node;
+            new_leaf_node->inflight = 1;
+            leaf->parent = new_in_node;
+            leaf_counts.fetch_add(LIVE);
+            // pushed before any other write can find the new leaf. It cannot land in the old
+            // leaf either : deliver() waits for its lock, then finds it moved.
+            push_write(root, key, 1, val, true); // LinP for success
+            ptr->store(new_in_node);             // LinP for success without an inverse
+            leaf->tree_mtx.unlock();
             p->tree_mtx.unlock();
-            return true;
+            written = new_leaf_node;
+            break;
         }
+
+        push_write(root, key, 1, val, false);
+        if constexpr (!Agg::invertible)
+        {
+            // Our push came after the leaf unlock, so a later remove (or revive with another
+            // value) may have pushed first and had its path recomputed, leaving lift(val)
+            // behind us in clean nodes. Its operation no longer covers ours : dirty the path
+            // again with one that follows ours down.
+            written->tree_mtx.lock();
+            bool stale = written->removed.load() || written->value != val;
+            written->tree_mtx.unlock();
+            if (stale)
+                push_write(root, key, 0, val, false);
+        }
+        flush(root);
+        return true;
     };
 
     bool remove(InternalNode *root, int key)
     {
-        // TODO
-        LeafNode *prev_leaf = nullptr;
-        while (true)
+        if (key >= MAX_KEY)
+            return false; // never remove the sentinel
+        Guard guard(reclaimer);
+        LeafNode *leaf = std::get<2>(find(root, key));
+        if (leaf->key != key)
+            return false; // key not found
+
+        leaf->tree_mtx.lock();
+        bool removed = !leaf->removed.load(); // a compacted leaf is removed as well
+        long long val = leaf->value;
+        long long counts = 0;
+        if (removed)
         {
-            auto [gp, gp_dir, p, p_dir, leaf] = find(root, key);
-            if (leaf->key != key)
-                return false; // key not found
-            if (prev_leaf != nullptr && prev_leaf != leaf)
-                return false; // key deleted and re-added
-            prev_leaf = leaf;
+            leaf->inflight++;
+            push_write(root, key, -1, val, true); // LinP for success
+            leaf->removed.store(true);            // LinP for success without an inverse
+            counts = leaf_counts.fetch_add(1 - LIVE) + 1 - LIVE;
+        }
+        leaf->tree_mtx.unlock();
+        if (!removed)
+            return false;
 
-            gp->tree_mtx.lock();
-            p->tree_mtx.lock();
-            Edge *ptr = &(gp->child[gp_dir]);
-            if (gp->removed.load() || ptr->load() != p)
+        push_write(root, key, -1, val, false);
+        flush(root);
+        long long removed_leaves = counts & REMOVED_MASK;
+        if (removed_leaves > 2 * (counts / LIVE) + MIN_COMPACT && removed_leaves > compact_at.load(std::memory_order_relaxed))
+            compact();
+        return true;
+    }
+
+    // Unlinks the removed leaves whose operations all arrived, each with its parent, whose
+    // other child takes its place. Removed leaves would otherwise pile up, the tree only
+    // grows on the write path. remove() calls it once removed leaves outnumber twice the live
+    // ones (plus MIN_COMPACT), and twice what the last time left, so the tree stays within
+    // about 3 times its live leaves and the walk costs O(1) amortized per remove.
+    // It runs alone, keeping propagations and snapshots out like a snapshot keeps
+    // propagations out, and propagates the whole tree on the way, since removes wait in the
+    // buffers above their leaf for long. Then only writers' pushes to the root move
+    // operations. Writers go on meanwhile, under the locks insert() takes, and the removes
+    // they pushed during the walk are propagated and unlinked after it, along their paths.
+    void compact()
+    {
+        bool expected = false;
+        if (!compacting.compare_exchange_strong(expected, true))
+            return; // someone else is on it
+        Backoff backoff;
+        while (propagators.load() > 0 || snapshots.load() > 0)
+            backoff.pause();
+        Guard guard(reclaimer);
+        {
+            // this propagates everything, and unlink() passes over queued nodes
+            std::lock_guard<std::mutex> lock(work_mtx);
+            while (!work_queue.empty())
             {
-                gp->tree_mtx.unlock();
-                p->tree_mtx.unlock();
+                work_queue.top().second->queued.store(false, std::memory_order_relaxed);
+                work_queue.pop();
+            }
+        }
+
+        // Edges, propagated top down and unlinked bottom up : a removed leaf whose sibling
+        // went with their parent takes its place, and is looked at again one level up.
+        propagate(root);
+        std::vector<std::tuple<InternalNode *, int, bool>> stack = {{root, 0, false}}; // children done
+        while (!stack.empty())
+        {
+            auto [g, g_dir, children_done] = stack.back();
+            stack.pop_back();
+            Node *nd = g->child[g_dir].load();
+            if (nd == nullptr || nd->is_leaf)
                 continue;
+            auto p = (InternalNode *)nd;
+            if (!children_done)
+            {
+                propagate(p);
+                stack.push_back({g, g_dir, true});
+                stack.push_back({p, 0, false});
+                stack.push_back({p, 1, false});
             }
-            Node *remaining_leaf = p->child[1 - p_dir].load();
-            Node *target_leaf = p->child[p_dir].load();
-            if (target_leaf != leaf)
+            else if (!unlink(g, g_dir, p, 0))
+                unlink(g, g_dir, p, 1);
+        }
+
+        // Only propagation takes operations out of the root's list, so what is behind its
+        // head stays put. Nodes other than the root only have what it propagates.
+        std::vector<int> keys;
+        for (Operation *op = root->ops.load(std::memory_order_acquire); op != nullptr; op = op->next)
+            if (op->type < 0)
+                keys.push_back(op->key);
+        std::vector<InternalNode *> pending = {root};
+        while (!pending.empty())
+        {
+            InternalNode *nd = pending.back();
+            pending.pop_back();
+            propagate(nd);
+            for (auto &c : nd->child)
             {
-                gp->tree_mtx.unlock();
-                p->tree_mtx.unlock();
-                continue;
+                Node *child = c.load();
+                if (child != nullptr && !child->is_leaf && child->pending.load(std::memory_order_relaxed) > 0)
+                    pending.push_back((InternalNode *)child);
             }
+        }
+        for (int key : keys)
+        {
+            InternalNode *g = nullptr, *p = root;
+            int g_dir = 0, p_dir = 0;
+            Node *nd = root->child[0].load();
+            while (!nd->is_leaf)
+            {
+                g = p;
+                g_dir = p_dir;
+                p = (InternalNode *)nd;
+                p_dir = p->key <= key;
+                nd = p->child[p_dir].load();
+            }
+            if (g != nullptr && nd->key == key)
+                unlink(g, g_dir, p, p_dir);
+        }
 
-            root->op_mutex.lock();
-            root->op_queue.push({key, leaf->value, -1});
-            root->sum.fetch_sub(leaf->value);
-            root->op_mutex.unlock();
+        compact_at.store(2 * (leaf_counts.load() & REMOVED_MASK));
+        compacting.store(false);
+    }
 
-            p->removed.store(true);
-            ptr->store(remaining_leaf);
+    // unlinks p, g's child in g_dir, and its child in dir if that is a removed leaf with no
+    // operations on the way (compact() only)
+    bool unlink(InternalNode *g, int g_dir, InternalNode *p, int dir)
+    {
+        Node *child = p->child[dir].load();
+        if (!child->is_leaf || !child->removed.load())
+            return false;
+        auto leaf = (LeafNode *)child;
+        g->tree_mtx.lock();
+        p->tree_mtx.lock();
+        leaf->tree_mtx.lock();
+        bool ok = g->child[g_dir].load() == p && p->child[dir].load() == leaf && leaf->parent == p &&
+                  leaf->removed.load() && leaf->inflight == 0;
+        if (ok)
+        {
+            // a queued node would stay in the queue after it is freed
+            std::lock_guard<std::mutex> lock(work_mtx);
+            ok = !p->queued.load(std::memory_order_relaxed);
+            if (ok)
+                p->removed.store(true); // inserts stop splitting under it, and it is never queued
+        }
+        leaf->tree_mtx.unlock();
+        if (!ok)
+        {
+            p->tree_mtx.unlock();
+            g->tree_mtx.unlock();
+            return false;
+        }
 
-            // TODO remove nodes
-            // delete p;
-            // delete l;
+        // Nothing propagates, so p's pending operations stay put, and none is on leaf's key.
+        // They go to the sibling, which p counted them for. Without an inverse, a dirty
+        // sibling has a dirty p, which has a dirty g.
+        Node *sibling = p->child[1 - dir].load();
+        Operation *op = p->ops.exchange(nullptr);
+        while (op != nullptr)
+        {
+            Operation *next = op->next;
+            if (!sibling->is_leaf)
+                push(sibling, op);
+            else
+            {
+                deliver((LeafNode *)sibling, p, op);
+                NodePool<Operation>::destroy(op);
+            }
+            op = next;
+        }
+        if (sibling->is_leaf)
+        {
+            sibling->tree_mtx.lock();
+            ((LeafNode *)sibling)->parent = g;
+            sibling->tree_mtx.unlock();
+        }
+        g->child[g_dir].store(sibling);
+        leaf->tree_mtx.lock();
+        leaf->parent = nullptr;
+        leaf->tree_mtx.unlock();
+        leaf_counts.fetch_sub(1);
+        p->tree_mtx.unlock();
+        g->tree_mtx.unlock();
+        reclaimer.retire(leaf);
+        reclaimer.retire(p);
+        return true;
+    }
 
-            gp->tree_mtx.unlock();
-            p->tree_mtx.unlock();
-            return true;
+    // operations pushed to a node and not propagated yet, over the whole tree (not thread-safe)
+    long pending_count()
+    {
+        long count = 0;
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            count += nd->pending.load();
+            if (!nd->is_leaf)
+                for (auto &c : ((InternalNode *)nd)->child)
+                    if (c.load() != nullptr)
+                        stack.push_back(c.load());
         }
+        return count;
     }
 
-    int sum(InternalNode *root, int key_st, int key_ed)
+    // nodes in the tree, internal and leaves (not thread-safe)
+    long node_count()
     {
-        // sum for [key_st, key_ed]
+        long count = 0;
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            count += 1;
+            if (!nd->is_leaf)
+                for (auto &c : ((InternalNode *)nd)->child)
+                    if (c.load() != nullptr)
+                        stack.push_back(c.load());
+        }
+        return count;
+    }
 
+    // Aggregate of the values in [key_st, key_ed] (the sum, for Sum).
+    // Weakly consistent : subtrees are read at different times while operations move down,
+    // so a concurrent write may be missed even after it returned. snapshot_sum() is exact.
+    Value sum(InternalNode *root, int key_st, int key_ed)
+    {
+        Guard guard(reclaimer);
+        enter_propagation();
+        Value result = sum_propagating(root, key_st, key_ed);
+        exit_propagation();
+        return result;
+    }
+
+    Value sum_propagating(InternalNode *root, int key_st, int key_ed)
+    {
         Node *nd = root;
-        // TODO lock
         while (nd != nullptr && !nd->is_leaf)
         {
-            // nd->tree_mtx.lock();
-            // nd->tree_mtx.unlock();
-            // TODO propagate, move lock
             propagate((InternalNode *)nd);
             bool st_dir = nd->key <= key_st;
             bool ed_dir = nd->key <= key_ed;
@@ -203,20 +1030,18 @@ struct LeafTree
         }
 
         if (nd == nullptr)
-            return 0;
+            return Agg::identity();
 
         if (nd->is_leaf)
         {
             if (key_st <= nd->key && nd->key <= key_ed)
-                return ((LeafNode *)nd)->value;
+                return subtree(nd);
             else
-                return 0;
+                return Agg::identity();
         }
 
         InternalNode *sub_root = (InternalNode *)nd;
-        // TODO lock
-
-        int result = 0;
+        Value result = Agg::identity();
         int keys[2] = {key_st, key_ed};
         std::queue<std::pair<Node *, int>> q;
         q.push({sub_root->child[0], 0});
@@ -225,45 +1050,1010 @@ struct LeafTree
         {
             auto [nd, r_dir] = q.front();
             q.pop();
+            if (nd == nullptr)
+                continue; // right of the root
             if (nd->is_leaf)
             {
                 if (key_st <= nd->key && nd->key <= key_ed)
-                    result += ((LeafNode *)nd)->value;
+                    result = Agg::combine(result, subtree(nd));
             }
             else
             {
                 InternalNode *cur = (InternalNode *)nd;
                 propagate(cur);
-                // TODO propagate, move lock
                 int key = keys[r_dir];
                 int dir = nd->key <= key;
 
-                // if I should go to r_dir, add the other subtree sum. if not, just go.
+                // if I should go to r_dir, add the other subtree. if not, just go.
                 if (r_dir == dir)
+                    result = Agg::combine(result, subtree(cur->child[1 - dir].load()));
+                q.push({cur->child[dir], r_dir});
+            }
+        }
+        return result;
+    }
+
+    // Aggregates for many ranges at once, results in the order of ranges (invertible only).
+    // sum(st, ed) is prefix(ed) - prefix(st - 1), where prefix(k) sums the keys up to k.
+    // The prefixes of all range ends are found in one descent over the union of their paths,
+    // which propagates each node on it once, and reads the sums of left subtrees on the way
+    // down. A node shared by many paths (the top of the tree, for all of them) is visited once
+    // instead of twice per query. The descent is split across thread_count threads.
+    std::vector<Value> sum_batch(InternalNode *root, const std::vector<std::pair<int, int>> &ranges, int thread_count = 1)
+    {
+        static_assert(Agg::invertible, "prefix differences need an inverse");
+        std::vector<int> keys;
+        keys.reserve(2 * ranges.size());
+        for (auto [st, ed] : ranges)
+        {
+            keys.push_back(ed);
+            if (st > std::numeric_limits<int>::min())
+                keys.push_back(st - 1);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::vector<Value> prefix(keys.size());
+        Guard guard(reclaimer);
+        enter_propagation();
+        prefix_sums(root, keys.data(), 0, keys.size(), Agg::identity(), prefix.data(), thread_count);
+        exit_propagation();
+
+        auto prefix_of = [&](int key)
+        {
+            return prefix[std::lower_bound(keys.begin(), keys.end(), key) - keys.begin()];
+        };
+        std::vector<Value> results(ranges.size(), Agg::identity());
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            auto [st, ed] = ranges[i];
+            if (st <= ed)
+                results[i] = st > std::numeric_limits<int>::min()
+                                 ? Agg::combine(prefix_of(ed), Agg::inverse(prefix_of(st - 1)))
+                                 : prefix_of(ed);
+        }
+        return results;
+    }
+
+    // out[i] = aggregate of the keys up to keys[i], for the sorted keys[lo, hi) under top,
+    // whose left is worth acc
+    void prefix_sums(Node *top, const int *keys, int top_lo, int top_hi, Value top_acc, Value *out, int thread_count)
+    {
+        std::vector<std::tuple<Node *, int, int, Value>> stack = {{top, top_lo, top_hi, top_acc}};
+        while (!stack.empty())
+        {
+            Node *nd;
+            int lo, hi;
+            Value acc;
+            std::tie(nd, lo, hi, acc) = stack.back();
+            stack.pop_back();
+            if (lo == hi)
+                continue;
+            if (nd == nullptr || nd->is_leaf)
+            {
+                Value leaf_agg = subtree(nd);
+                for (int i = lo; i < hi; i++)
+                    out[i] = nd != nullptr && nd->key <= keys[i] ? Agg::combine(acc, leaf_agg) : acc;
+                continue;
+            }
+
+            auto in = (InternalNode *)nd;
+            propagate(in);
+            Node *left = in->child[0].load(), *right = in->child[1].load();
+            int mid = std::lower_bound(keys + lo, keys + hi, in->key) - keys; // [lo, mid) go left
+            Value right_acc = Agg::combine(acc, subtree(left));
+            if (thread_count > 1 && lo != mid && mid != hi)
+            {
+                // left on a new thread, right here
+                std::thread t([&]()
+                              { prefix_sums(left, keys, lo, mid, acc, out, thread_count / 2); });
+                prefix_sums(right, keys, mid, hi, right_acc, out, thread_count - thread_count / 2);
+                t.join();
+            }
+            else
+            {
+                stack.push_back({left, lo, mid, acc});
+                stack.push_back({right, mid, hi, right_acc});
+            }
+        }
+    }
+
+    // Smallest key in [key_st, key_ed] whose value reaches threshold (Agg::reaches, so Min
+    // and Max), MAX_KEY if there is none. Subtrees whose aggregate does not reach it are
+    // skipped whole, so a rare hit costs about a path per subtree that holds one.
+    int first_reaching(InternalNode *root, int key_st, int key_ed, Value threshold)
+    {
+        int first = MAX_KEY;
+        Guard guard(reclaimer);
+        enter_propagation();
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            if (nd == nullptr || !Agg::reaches(subtree(nd), threshold))
+                continue;
+            if (nd->is_leaf)
+            {
+                if (key_st <= nd->key && nd->key <= key_ed)
                 {
-                    Node *other_subtree = cur->child[1 - dir].load();
-                    result += (other_subtree == nullptr) ? 0 : other_subtree->sum.load();
+                    first = nd->key;
+                    break;
                 }
-                q.push({cur->child[dir], r_dir});
+                continue;
             }
+
+            auto in = (InternalNode *)nd;
+            propagate(in);
+            // left on top
+            if (in->key <= key_ed)
+                stack.push_back(in->child[1].load());
+            if (key_st < in->key)
+                stack.push_back(in->child[0].load());
         }
+        exit_propagation();
+        return first;
+    }
+
+    // Aggregate of the values in [key_st, key_ed] at one point in time, for invertible Agg.
+    // Every write pushes its operation to the root, and those of a key arrive in the order
+    // of its writes, so the state at any moment is the set of operations in the tree. While
+    // nothing propagates, that set only grows at the root's list : a snapshot waits out the
+    // running propagations (writers skip theirs, they are never blocked), then reads the
+    // root's list head, which is the linearization point. Below that everything holds still.
+    // Nodes inside the range count whole, and the ones partly in it add their pending
+    // operations in the range. The paths are propagated first, so little is left pending.
+    Value snapshot_sum(InternalNode *root, int key_st, int key_ed)
+    {
+        static_assert(Agg::invertible, "pending operations are added as they are, removes included");
+        Guard guard(reclaimer);
+        enter_propagation();
+        snapshot_walk(root, key_st, key_ed, false);
+        exit_propagation();
+
+        enter_snapshot();
+        Value result = snapshot_walk(root, key_st, key_ed, true);
+        exit_snapshot();
+        return result;
+    }
+
+    // nodes with keys in [key_st, key_ed] : propagates the ones partly in it, or reads them all
+    Value snapshot_walk(InternalNode *root, int key_st, int key_ed, bool read)
+    {
+        Value result = Agg::identity();
+        // node, and its keys are in [lo, hi)
+        std::vector<std::tuple<Node *, long long, long long>> stack = {
+            {root, std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max()}};
+        while (!stack.empty())
+        {
+            auto [nd, lo, hi] = stack.back();
+            stack.pop_back();
+            if (nd == nullptr)
+                continue;
+            if (nd->is_leaf)
+            {
+                if (read && key_st <= nd->key && nd->key <= key_ed)
+                    result = Agg::combine(result, nd->agg.load());
+                continue;
+            }
+            if (nd != root && key_st <= lo && hi - 1 <= key_ed)
+            {
+                if (read)
+                    result = Agg::combine(result, nd->agg.load());
+                continue;
+            }
 
-        // TODO unlock everything
+            auto in = (InternalNode *)nd;
+            if (read)
+            {
+                for (Operation *op = in->ops.load(std::memory_order_acquire); op != nullptr; op = op->next)
+                    if (key_st <= op->key && op->key <= key_ed)
+                        result = Agg::combine(result, delta(op));
+            }
+            else
+                propagate(in);
+            if (key_st < in->key)
+                stack.push_back({in->child[0].load(), lo, std::min<long long>(hi, in->key)});
+            if (in->key <= key_ed)
+                stack.push_back({in->child[1].load(), std::max<long long>(lo, in->key), hi});
+        }
         return result;
     }
 
     //
     bool search(InternalNode *root, int key)
     {
+        Guard guard(reclaimer);
         Node *nd = root->child[0].load();
         while (!nd->is_leaf)
         {
             auto nd_child = ((InternalNode *)nd)->child;
-            Edge *ptr = (key < nd->key) ? &(nd_child[0]) : &(nd_child[1]);
+            Edge<Agg> *ptr = (key < nd->key) ? &(nd_child[0]) : &(nd_child[1]);
             nd = ptr->load();
         }
 
         auto leaf = (LeafNode *)nd;
-        return leaf->key == key && !leaf->removed.load();
+        return leaf->key == key && key < MAX_KEY && !leaf->removed.load();
     }
 };
+
+// Random inserts and removes on [0, elem_max) from thread_count threads, every one of them
+// goes through the root's pending list.
+void write_test(int thread_count, int ops_count, int elem_max)
+{
+    LeafTree<> tree;
+    std::mt19937 fill(0);
+    for (int i = 0; i < elem_max / 2; i++)
+        tree.insert(tree.root, fill() % elem_max, 1);
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                int key = gen() % elem_max;
+                if (gen() % 2)
+                    tree.insert(tree.root, key, 1);
+                else
+                    tree.remove(tree.root, key);
+            } }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << thread_count << " threads : " << ms << "ms, " << (long long)ops_count / (ms + 1) << " ops/ms" << std::endl;
+}
+
+// Writers fill a tree with a given buffer limit, then one query pays whatever is still
+// pending. Then sum() over random ranges while the writers keep going.
+void buffer_test(int buffer_limit, int thread_count, int ops_count, int elem_max)
+{
+    LeafTree<> tree(buffer_limit);
+    auto write = [&](int seed, int count)
+    {
+        std::mt19937 gen(seed);
+        for (int i = 0; i < count; i++)
+        {
+            int key = gen() % elem_max;
+            if (gen() % 2)
+                tree.insert(tree.root, key, 1);
+            else
+                tree.remove(tree.root, key);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+        threads.push_back(std::thread(write, id, ops_count / thread_count));
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long write_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    long pending = tree.pending_count();
+
+    start = std::chrono::high_resolution_clock::now();
+    tree.sum(tree.root, 0, elem_max);
+    end = std::chrono::high_resolution_clock::now();
+    long first_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    threads.clear();
+    for (int id = 0; id < thread_count; id++)
+        threads.push_back(std::thread(write, thread_count + id, ops_count / thread_count));
+    std::mt19937 gen(0);
+    long long total_us = 0, max_us = 0, queries = 0;
+    for (; queries < 1000; queries++)
+    {
+        int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+        auto query_start = std::chrono::high_resolution_clock::now();
+        tree.sum(tree.root, st, ed);
+        auto query_end = std::chrono::high_resolution_clock::now();
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(query_end - query_start).count();
+        total_us += us;
+        max_us = std::max(max_us, us);
+    }
+    for (auto &t : threads)
+        t.join();
+
+    std::cout << "limit " << buffer_limit << " : writes " << (long long)ops_count / (write_ms + 1) << " ops/ms, pending "
+              << pending << ", first sum " << first_us << "us, sum under writes avg " << total_us / queries
+              << "us max " << max_us << "us" << std::endl;
+}
+
+// writer_count writers with a buffer limit and worker_count background workers, while this
+// thread runs a sum() over a random range every millisecond. Reports the sum() latency
+// percentiles, so what queries still pay for propagation.
+void worker_test(int buffer_limit, int worker_count, int writer_count, int ops_count, int elem_max)
+{
+    LeafTree<> tree(buffer_limit, worker_count);
+    std::atomic<int> running(writer_count);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < writer_count; id++)
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / writer_count; i++)
+            {
+                int key = gen() % elem_max;
+                if (gen() % 2)
+                    tree.insert(tree.root, key, 1);
+                else
+                    tree.remove(tree.root, key);
+            }
+            running--; }));
+
+    std::mt19937 gen(0);
+    std::vector<long long> latencies;
+    while (running.load() > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+        auto query_start = std::chrono::high_resolution_clock::now();
+        tree.sum(tree.root, st, ed);
+        auto query_end = std::chrono::high_resolution_clock::now();
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(query_end - query_start).count());
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    std::sort(latencies.begin(), latencies.end());
+    latencies.push_back(0); // in case there were none
+    std::cout << "limit " << buffer_limit << ", " << worker_count << " workers : writes " << (long long)ops_count / (ms + 1)
+              << " ops/ms, " << latencies.size() - 1 << " sums, p50 " << latencies[(latencies.size() - 1) / 2]
+              << "us, p99 " << latencies[(latencies.size() - 1) * 99 / 100] << "us" << std::endl;
+}
+
+// query_count random range sums on identically filled trees, one sum() at a time and by
+// sum_batch() over thread_count threads. The first round pays for propagating what the
+// writes left pending, the second one finds nothing pending on the paths.
+void batch_query_test(int buffer_limit, int query_count, int thread_count, int ops_count, int elem_max)
+{
+    auto fill = [&](LeafTree<> &tree)
+    {
+        std::mt19937 gen(0);
+        for (int i = 0; i < ops_count; i++)
+        {
+            int key = gen() % elem_max;
+            if (gen() % 2)
+                tree.insert(tree.root, key, key % 100);
+            else
+                tree.remove(tree.root, key);
+        }
+    };
+    std::vector<std::pair<int, int>> ranges(query_count);
+    std::mt19937 gen(1);
+    for (auto &[st, ed] : ranges)
+    {
+        st = gen() % elem_max;
+        ed = st + gen() % (elem_max - st);
+    }
+
+    LeafTree<> single_tree(buffer_limit), batch_tree(buffer_limit);
+    fill(single_tree);
+    fill(batch_tree);
+
+    std::cout << "limit " << buffer_limit << ", " << thread_count << " threads :";
+    for (int round = 0; round < 2; round++)
+    {
+        std::vector<long long> expected(query_count);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < query_count; i++)
+            expected[i] = single_tree.sum(single_tree.root, ranges[i].first, ranges[i].second);
+        auto end = std::chrono::high_resolution_clock::now();
+        long single_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        start = std::chrono::high_resolution_clock::now();
+        std::vector<long long> results = batch_tree.sum_batch(batch_tree.root, ranges, thread_count);
+        end = std::chrono::high_resolution_clock::now();
+        long batch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        assert(results == expected);
+
+        std::cout << (round == 0 ? " pending" : ", propagated") << " : one by one " << single_ns / query_count
+                  << "ns/query, batch " << batch_ns / query_count << "ns/query";
+    }
+    std::cout << std::endl;
+}
+
+// Random inserts, removes and range queries against std::map, one thread (and workers)
+template <typename Agg>
+void check_test(int buffer_limit, int worker_count = 0)
+{
+    typedef typename Agg::Value Value;
+    LeafTree<Agg> tree(buffer_limit, worker_count);
+    std::map<int, int> ref;
+    std::mt19937 gen(buffer_limit);
+    for (int i = 0; i < 100000; i++)
+    {
+        int key = gen() % 1000, val = gen() % 100;
+        if (i % 3 == 0)
+        {
+            assert(tree.insert(tree.root, key, val) == !ref.count(key));
+            ref.insert({key, val});
+        }
+        else if (i % 3 == 1)
+        {
+            assert(tree.remove(tree.root, key) == (bool)ref.count(key));
+            ref.erase(key);
+        }
+        else
+        {
+            int st = std::min(key, val * 10), ed = std::max(key, val * 10);
+            Value expected = Agg::identity();
+            for (auto it = ref.lower_bound(st); it != ref.end() && it->first <= ed; ++it)
+                expected = Agg::combine(expected, Agg::lift(it->second));
+            if constexpr (Agg::invertible)
+                assert(tree.snapshot_sum(tree.root, st, ed) == expected);
+            assert(tree.sum(tree.root, st, ed) == expected);
+            if constexpr (!Agg::invertible)
+            {
+                Value threshold = gen() % 100;
+                int first = tree.MAX_KEY;
+                for (auto it = ref.lower_bound(st); it != ref.end() && it->first <= ed; ++it)
+                    if (Agg::reaches(Agg::lift(it->second), threshold))
+                    {
+                        first = it->first;
+                        break;
+                    }
+                assert(tree.first_reaching(tree.root, st, ed, threshold) == first);
+            }
+        }
+    }
+}
+
+// thread_count writers on disjoint keys with values in [0, 1000), while this thread runs
+// range queries (and first_reaching() for the rarest value, where there is one). Then the
+// tree is checked against what the writers did.
+template <typename Agg>
+void aggregate_test(std::string name, int thread_count, int ops_count, int elem_max)
+{
+    typedef typename Agg::Value Value;
+    LeafTree<Agg> tree;
+    std::vector<std::map<int, int>> refs(thread_count);
+    std::atomic<int> running(thread_count);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                int key = gen() % elem_max / thread_count * thread_count + id;
+                if (gen() % 2)
+                {
+                    int val = gen() % 1000;
+                    if (tree.insert(tree.root, key, val))
+                        refs[id][key] = val;
+                }
+                else if (tree.remove(tree.root, key))
+                    refs[id].erase(key);
+            }
+            running--; }));
+
+    std::mt19937 gen(0);
+    Value rare = Agg::combine(Agg::lift(0), Agg::lift(999));
+    long long sum_ns = 0, first_ns = 0, queries = 0;
+    while (running.load() > 0)
+    {
+        int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+        auto query_start = std::chrono::high_resolution_clock::now();
+        tree.sum(tree.root, st, ed);
+        auto query_end = std::chrono::high_resolution_clock::now();
+        sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(query_end - query_start).count();
+        if constexpr (!Agg::invertible)
+        {
+            query_start = std::chrono::high_resolution_clock::now();
+            tree.first_reaching(tree.root, st, ed, rare);
+            query_end = std::chrono::high_resolution_clock::now();
+            first_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(query_end - query_start).count();
+        }
+        queries++;
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    std::map<int, int> ref;
+    for (auto &r : refs)
+        ref.insert(r.begin(), r.end());
+    for (int i = 0; i < 1000; i++)
+    {
+        int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+        Value expected = Agg::identity();
+        for (auto it = ref.lower_bound(st); it != ref.end() && it->first <= ed; ++it)
+            expected = Agg::combine(expected, Agg::lift(it->second));
+        assert(tree.sum(tree.root, st, ed) == expected);
+    }
+
+    std::cout << name << " : writes " << (long long)ops_count / (ms + 1) << " ops/ms, " << queries
+              << " queries under writes, sum avg " << sum_ns / (queries + 1) / 1000 << "us";
+    if (!Agg::invertible)
+        std::cout << ", first_reaching avg " << first_ns / (queries + 1) / 1000 << "us";
+    std::cout << std::endl;
+}
+
+// thread_count writers all inserting and removing the same few keys with random values,
+// while this thread runs range queries. After each round, every range must match the leaves
+// the writers left behind (a revive racing a remove must not leave its value in the path).
+template <typename Agg>
+void shared_key_test(std::string name, int buffer_limit, int thread_count, int rounds, int ops_per_round, int elem_max)
+{
+    typedef typename Agg::Value Value;
+    LeafTree<Agg> tree(buffer_limit);
+    long long queries = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        std::atomic<int> running(thread_count);
+        std::vector<std::thread> threads;
+        for (int id = 0; id < thread_count; id++)
+            threads.push_back(std::thread([&, id]()
+                                          {
+                std::mt19937 gen(r * thread_count + id);
+                for (int i = 0; i < ops_per_round / thread_count; i++)
+                {
+                    int key = gen() % elem_max;
+                    if (gen() % 2)
+                        tree.insert(tree.root, key, gen() % 1000);
+                    else
+                        tree.remove(tree.root, key);
+                }
+                running--; }));
+
+        std::mt19937 gen(r);
+        while (running.load() > 0)
+        {
+            int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+            tree.sum(tree.root, st, ed);
+            queries++;
+        }
+        for (auto &t : threads)
+            t.join();
+
+        std::map<int, long long> ref;
+        for (int key = 0; key < elem_max; key++)
+            if (tree.search(tree.root, key))
+                ref[key] = std::get<2>(tree.find(tree.root, key))->value;
+        for (int st = 0; st < elem_max; st++)
+        {
+            Value expected = Agg::identity();
+            for (int ed = st; ed < elem_max; ed++)
+            {
+                if (ref.count(ed))
+                    expected = Agg::combine(expected, Agg::lift(ref[ed]));
+                assert(tree.sum(tree.root, st, ed) == expected);
+            }
+        }
+    }
+
+    std::cout << name << " : " << rounds << " rounds, " << queries << " queries under writes" << std::endl;
+}
+
+// Linearizability check of range sums under writes. Each of 4 tracked writers owns a key
+// and alternates inserting and removing it, its j-th insert with value j + 1 in the writer's
+// own 16 bits of the sum, while noise writers insert and remove other keys with value 0 (so
+// there are splits and flushes, and the sums do not change). A query thread sums everything,
+// and each sum reads as one state per tracked writer. Given when the writers' operations
+// started and ended, there must be a moment within the query where all of them could have
+// been in those states at once.
+// Slow queries would see only a handful of sums before ops_count runs out, so past it the
+// tracked writers keep going, PACE operations per finished query, until MIN_QUERIES are done.
+template <typename Query>
+void snapshot_test(std::string name, Query query, int buffer_limit, int worker_count, int ops_count, int elem_max)
+{
+    const int TRACKED = 4, NOISE = 2, MIN_QUERIES = 200, PACE = 100;
+    const long long INF = std::numeric_limits<long long>::max();
+    const int max_ops = ops_count + PACE * MIN_QUERIES;
+    assert(max_ops / 2 < 0xFFFF); // insert values fit in a writer's 16 bits
+    LeafTree<> tree(buffer_limit, worker_count);
+    std::atomic<long long> clock(0);
+    std::vector<std::vector<long long>> starts(TRACKED, std::vector<long long>(max_ops)), ends = starts;
+    std::vector<int> done(TRACKED); // operations per tracked writer
+    std::atomic<int> queries_done(0);
+    auto tracked_key = [&](int w)
+    { return (2 * w + 1) * (elem_max / TRACKED / 2); };
+    auto is_tracked = [&](int key)
+    {
+        for (int w = 0; w < TRACKED; w++)
+            if (key == tracked_key(w))
+                return true;
+        return false;
+    };
+    std::mt19937 fill(0);
+    for (int i = 0; i < elem_max / 2; i++)
+    {
+        int key = fill() % elem_max;
+        if (!is_tracked(key))
+            tree.insert(tree.root, key, 0);
+    }
+
+    std::atomic<int> running(TRACKED);
+    std::atomic<long long> noise_ops(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int w = 0; w < TRACKED; w++)
+        threads.push_back(std::thread([&, w]()
+                                      {
+            int j = 0;
+            for (; j < ops_count || (j < max_ops && queries_done.load() < MIN_QUERIES); j++)
+            {
+                while (j >= ops_count + PACE * queries_done.load() && queries_done.load() < MIN_QUERIES)
+                    std::this_thread::yield();
+                starts[w][j] = clock++;
+                bool ok = j % 2 == 0 ? tree.insert(tree.root, tracked_key(w), (long long)(j / 2 + 1) << (16 * w))
+                                     : tree.remove(tree.root, tracked_key(w));
+                ends[w][j] = clock++;
+                assert(ok);
+            }
+            done[w] = j;
+            running--; }));
+    for (int id = 0; id < NOISE; id++)
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            while (running.load() > 0)
+            {
+                int key = gen() % elem_max;
+                if (is_tracked(key))
+                    continue;
+                if (gen() % 2)
+                    tree.insert(tree.root, key, 0);
+                else
+                    tree.remove(tree.root, key);
+                noise_ops++;
+            } }));
+
+    std::vector<std::tuple<long long, long long, long long>> results; // start, end, sum
+    long long query_ns = 0;
+    while (running.load() > 0)
+    {
+        long long query_start = clock++;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        long long result = query(tree, 0, elem_max);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        results.push_back({query_start, clock++, result});
+        query_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        queries_done++;
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    // windows [from, to] in which writer w may have been in the state of sum digit d
+    auto windows = [&](int w, long long d, long long from, long long to)
+    {
+        std::vector<std::pair<long long, long long>> found;
+        auto add = [&](int j) // state after operation j (-1 : before the first)
+        {
+            long long lo = j < 0 ? 0 : starts[w][j], hi = j + 1 < done[w] ? ends[w][j + 1] : INF;
+            if (lo <= to && hi >= from)
+                found.push_back({std::max(lo, from), std::min(hi, to)});
+        };
+        if (d > 0)
+        {
+            if (2 * (d - 1) < done[w])
+                add(2 * (d - 1));
+            return found;
+        }
+        add(-1);
+        // removes, from the first one that may end after from
+        int j = std::lower_bound(ends[w].begin(), ends[w].begin() + done[w], from) - ends[w].begin();
+        for (j = std::max(1, j - 2) | 1; j < done[w] && starts[w][j] <= to; j += 2)
+            add(j);
+        return found;
+    };
+
+    long long violations = 0;
+    for (auto [query_start, query_end, result] : results)
+    {
+        std::vector<std::vector<std::pair<long long, long long>>> states;
+        for (int w = 0; w < TRACKED; w++)
+            states.push_back(windows(w, (result >> (16 * w)) & 0xFFFF, query_start, query_end));
+        bool ok = false;
+        for (auto &ws : states)
+            for (auto [t, unused] : ws)
+            {
+                // some window of every writer holds t
+                bool all = true;
+                for (auto &other : states)
+                    all = all && std::any_of(other.begin(), other.end(), [&](auto window)
+                                             { return window.first <= t && t <= window.second; });
+                ok = ok || all;
+            }
+        violations += !ok;
+    }
+
+    std::cout << name << ", limit " << buffer_limit << ", " << worker_count << " workers : " << results.size() << " queries, avg "
+              << query_ns / (long long)(results.size() + 1) / 1000 << "us, " << violations
+              << " not linearizable, writes " << (std::accumulate(done.begin(), done.end(), 0LL) + noise_ops.load()) / (ms + 1)
+              << " ops/ms" << std::endl;
+    assert((int)results.size() >= MIN_QUERIES);
+    if (name == "snapshot_sum")
+        assert(violations == 0);
+}
+
+// One writer alternates inserting and removing a key, its n-th operation an insert with value
+// n when n is odd, while this thread searches the key and then takes a snapshot_sum() of it.
+// When no operation starts in between, and the search already saw the one in flight, the
+// snapshot must see it too : search() never gets ahead of snapshot_sum().
+void search_snapshot_test(int buffer_limit, int worker_count, int ops_count, int elem_max)
+{
+    const int KEY = elem_max / 2;
+    LeafTree<> tree(buffer_limit, worker_count);
+    for (int key = 0; key < elem_max; key += 2)
+        if (key != KEY)
+            tree.insert(tree.root, key, 0);
+    std::atomic<long long> started(0); // operations the writer started
+    std::thread writer([&]()
+                       {
+        for (long long n = 1; n <= ops_count; n++)
+        {
+            started.store(n);
+            if (n % 2 == 1)
+                assert(tree.insert(tree.root, KEY, n));
+            else
+                assert(tree.remove(tree.root, KEY));
+        } });
+
+    long long queries = 0, checked = 0;
+    while (started.load() < ops_count)
+    {
+        long long n = started.load();
+        bool found = tree.search(tree.root, KEY);
+        long long sum = tree.snapshot_sum(tree.root, KEY, KEY);
+        queries++;
+        assert(sum == 0 || (sum % 2 == 1 && sum <= started.load()));
+        if (started.load() != n || found != (n % 2 == 1))
+            continue;
+        assert(sum == (found ? n : 0));
+        checked++;
+    }
+    writer.join();
+    std::cout << "limit " << buffer_limit << ", " << worker_count << " workers : " << queries << " queries, "
+              << checked << " checked" << std::endl;
+}
+
+// thread_count writers on disjoint keys fill [0, elem_max), then remove all but about one in
+// 16 of their keys, round after round, while this thread runs range queries. After each
+// round the tree is checked against what the writers did, and its size against the keys
+// left : removed leaves must not pile up.
+template <typename Agg>
+void compact_test(std::string name, int buffer_limit, int worker_count, int thread_count, int rounds, int elem_max)
+{
+    typedef typename Agg::Value Value;
+    LeafTree<Agg> tree(buffer_limit, worker_count);
+    std::vector<std::map<int, int>> refs(thread_count);
+    long long queries = 0;
+    long max_nodes = 0;
+    for (int r = 0; r < rounds; r++)
+    {
+        std::atomic<int> running(thread_count);
+        std::vector<std::thread> threads;
+        for (int id = 0; id < thread_count; id++)
+            threads.push_back(std::thread([&, id]()
+                                          {
+                std::mt19937 gen(r * thread_count + id);
+                std::vector<int> keys; // in random order, the tree does not balance
+                for (int key = id; key < elem_max; key += thread_count)
+                    keys.push_back(key);
+                std::shuffle(keys.begin(), keys.end(), gen);
+                for (int key : keys)
+                {
+                    int val = gen() % 1000;
+                    if (tree.insert(tree.root, key, val))
+                        refs[id][key] = val;
+                }
+                for (int key : keys)
+                    if (gen() % 16 != 0 && tree.remove(tree.root, key))
+                        refs[id].erase(key);
+                running--; }));
+
+        std::mt19937 gen(r);
+        while (running.load() > 0)
+        {
+            int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+            tree.sum(tree.root, st, ed);
+            if constexpr (Agg::invertible)
+                tree.snapshot_sum(tree.root, st, ed);
+            queries++;
+        }
+        for (auto &t : threads)
+            t.join();
+
+        std::map<int, int> ref;
+        for (auto &rf : refs)
+            ref.insert(rf.begin(), rf.end());
+        for (int i = 0; i < 1000; i++)
+        {
+            int st = gen() % elem_max, ed = st + gen() % (elem_max - st);
+            Value expected = Agg::identity();
+            for (auto it = ref.lower_bound(st); it != ref.end() && it->first <= ed; ++it)
+                expected = Agg::combine(expected, Agg::lift(it->second));
+            assert(tree.sum(tree.root, st, ed) == expected);
+        }
+        long nodes = tree.node_count();
+        max_nodes = std::max(max_nodes, nodes);
+        assert(nodes < 8 * ((long)ref.size() + LeafTree<Agg>::MIN_COMPACT));
+    }
+
+    std::cout << name << ", limit " << buffer_limit << ", " << worker_count << " workers : " << rounds << " rounds, "
+              << queries << " queries under writes, at most " << max_nodes << " nodes after a round" << std::endl;
+}
+
+int main()
+{
+    LeafTree<>::debug_info();
+
+    {
+        LeafTree<> tree;
+        assert(!tree.search(tree.root, 1) && !tree.remove(tree.root, 1));
+        for (int k = 0; k < 100; k++)
+            assert(tree.insert(tree.root, k, k));
+        assert(!tree.insert(tree.root, 5, 5));
+        for (int k = 0; k < 100; k += 2)
+            assert(tree.remove(tree.root, k));
+        for (int k = 0; k < 100; k++)
+            assert(tree.search(tree.root, k) == (k % 2 == 1));
+        assert(tree.sum(tree.root, 0, 99) == 2500 && tree.sum(tree.root, 10, 20) == 75);
+        assert(tree.snapshot_sum(tree.root, 0, 99) == 2500 && tree.snapshot_sum(tree.root, 10, 20) == 75);
+        assert(tree.snapshot_sum(tree.root, 20, 10) == 0 && tree.sum(tree.root, 0, tree.MAX_KEY) == 2500);
+        assert(tree.insert(tree.root, 10, 1000) && tree.sum(tree.root, 10, 10) == 1000);
+        assert(!tree.remove(tree.root, tree.MAX_KEY) && !tree.insert(tree.root, tree.MAX_KEY, 1));
+        assert(tree.sum(tree.root, 0, tree.MAX_KEY) == 3500 && !tree.search(tree.root, tree.MAX_KEY));
+    }
+    {
+        // removed leaves are unlinked, and their keys come back as new leaves
+        LeafTree<> tree;
+        for (int k = 0; k < 1000; k++)
+            tree.insert(tree.root, k, k);
+        long full = tree.node_count();
+        for (int k = 0; k < 1000; k++)
+            if (k % 10 != 0)
+                assert(tree.remove(tree.root, k));
+        assert(tree.node_count() < full / 2);
+        for (int k = 0; k < 1000; k++)
+            assert(tree.search(tree.root, k) == (k % 10 == 0));
+        assert(tree.sum(tree.root, 0, 999) == 49500 && tree.snapshot_sum(tree.root, 0, 999) == 49500);
+        for (int k = 0; k < 1000; k++)
+            assert(tree.insert(tree.root, k, 1) == (k % 10 != 0));
+        assert(tree.sum(tree.root, 0, 999) == 49500 + 900 && tree.node_count() <= full);
+    }
+    {
+        LeafTree<> tree(0);
+        for (int k = 0; k < 100; k++)
+            tree.insert(tree.root, k, k);
+        std::vector<long long> sums = tree.sum_batch(tree.root, {{0, 99}, {10, 20}, {50, 50}, {-5, 3}, {200, 300}}, 4);
+        assert((sums == std::vector<long long>{4950, 165, 50, 6, 0}));
+    }
+    {
+        // sums past 32 and 64 bits
+        const long long big = std::numeric_limits<long long>::max();
+        LeafTree<> tree;
+        LeafTree<Sum<__int128>> wide_tree;
+        for (int k = 0; k < 100; k++)
+        {
+            tree.insert(tree.root, k, 1LL << 40);
+            wide_tree.insert(wide_tree.root, k, big);
+        }
+        wide_tree.remove(wide_tree.root, 50);
+        assert(tree.sum(tree.root, 0, 99) == 100LL << 40);
+        assert(wide_tree.sum(wide_tree.root, 0, 99) == (__int128)big * 99 && wide_tree.sum(wide_tree.root, 50, 50) == 0);
+        assert(wide_tree.sum_batch(wide_tree.root, {{0, 9}, {40, 59}}) == (std::vector<__int128>{(__int128)big * 10, (__int128)big * 19}));
+
+        // loads are never torn : the halves of what the writer stores always match
+        AtomicInt128 word;
+        std::atomic<bool> done(false);
+        std::thread writer([&]()
+                           {
+            for (long long i = 0; i < 1000000; i++)
+                word.store((__int128)i << 64 | i);
+            done = true; });
+        while (!done.load())
+        {
+            __int128 v = word.load();
+            assert((long long)(v >> 64) == (long long)v);
+        }
+        writer.join();
+    }
+    {
+        LeafTree<Max<>> tree;
+        for (int k = 0; k < 100; k++)
+            tree.insert(tree.root, k, k % 10);
+        assert(tree.sum(tree.root, 0, 99) == 9 && tree.sum(tree.root, 20, 25) == 5);
+        for (int k = 9; k < 100; k += 10)
+            tree.remove(tree.root, k);
+        assert(tree.sum(tree.root, 0, 99) == 8 && tree.sum(tree.root, 9, 9) == std::numeric_limits<long long>::min());
+        assert(tree.first_reaching(tree.root, 0, 99, 8) == 8 && tree.first_reaching(tree.root, 10, 99, 8) == 18);
+        assert(tree.first_reaching(tree.root, 0, 99, 9) == tree.MAX_KEY);
+    }
+    for (int limit : {0, 1, 4, 64})
+    {
+        check_test<Sum<int>>(limit);
+        check_test<Sum<>>(limit);
+        check_test<Sum<__int128>>(limit);
+        check_test<Count>(limit);
+        check_test<SumOfSquares<>>(limit);
+        check_test<Min<>>(limit);
+        check_test<Max<>>(limit);
+    }
+    check_test<Sum<>>(0, 2);
+    check_test<Max<>>(0, 2);
+
+    std::cout << " --- Write test --- " << std::endl;
+    for (int ths : {1, 2, 4, 8, 16, 32, 64})
+        write_test(ths, 2000000, 100000);
+    std::cout << " --- End of write test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Buffer test --- " << std::endl;
+    for (int limit : {0, 1024, 64, 8})
+        buffer_test(limit, 4, 2000000, 100000);
+    std::cout << " --- End of buffer test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Worker test --- " << std::endl;
+    for (int limit : {0, 64})
+        for (int workers : {0, 1, 2})
+            worker_test(limit, workers, 2, 2000000, 100000);
+    std::cout << " --- End of worker test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Batch query test --- " << std::endl;
+    for (int limit : {0, 64})
+        for (int ths : {1, 4})
+            batch_query_test(limit, 10000, ths, 1000000, 100000);
+    std::cout << " --- End of batch query test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Snapshot test --- " << std::endl;
+    for (auto [limit, workers] : {std::pair{0, 0}, {64, 0}, {8, 0}, {0, 2}})
+    {
+        snapshot_test("sum", [](LeafTree<> &tree, int st, int ed)
+                      { return tree.sum(tree.root, st, ed); }, limit, workers, 100000, 100000);
+        snapshot_test("snapshot_sum", [](LeafTree<> &tree, int st, int ed)
+                      { return tree.snapshot_sum(tree.root, st, ed); }, limit, workers, 100000, 100000);
+    }
+    for (auto [limit, workers] : {std::pair{8, 0}, {64, 0}, {8, 2}})
+        search_snapshot_test(limit, workers, 200000, 1000);
+    std::cout << " --- End of snapshot test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Aggregate test --- " << std::endl;
+    aggregate_test<Sum<int>>("sum32", 4, 1000000, 100000);
+    aggregate_test<Sum<>>("sum64", 4, 1000000, 100000);
+    aggregate_test<Sum<__int128>>("sum128", 4, 1000000, 100000);
+    aggregate_test<Count>("count", 4, 1000000, 100000);
+    aggregate_test<SumOfSquares<>>("sum of squares", 4, 1000000, 100000);
+    aggregate_test<Min<>>("min", 4, 1000000, 100000);
+    aggregate_test<Max<>>("max", 4, 1000000, 100000);
+    std::cout << " --- End of aggregate test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Shared key test --- " << std::endl;
+    for (int limit : {0, 8, 64})
+    {
+        shared_key_test<Sum<>>("sum, limit " + std::to_string(limit), limit, 4, 100, 2000, 16);
+        shared_key_test<Min<>>("min, limit " + std::to_string(limit), limit, 4, 100, 2000, 16);
+        shared_key_test<Max<>>("max, limit " + std::to_string(limit), limit, 4, 100, 2000, 16);
+    }
+    std::cout << " --- End of shared key test --- " << std::endl
+              << std::endl;
+
+    std::cout << " --- Compact test --- " << std::endl;
+    for (auto [limit, workers] : {std::pair{0, 0}, {64, 0}, {64, 2}})
+    {
+        compact_test<Sum<>>("sum", limit, workers, 4, 4, 100000);
+        compact_test<Max<>>("max", limit, workers, 4, 4, 100000);
+    }
+    std::cout << " --- End of compact test --- " << std::endl;
+
+    return 0;
+}
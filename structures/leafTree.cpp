@@ -9,152 +9,2214 @@
 #include <vector>
 #include <chrono>
 #include <string>
-#include <mutex>
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <type_traits>
+#include <unistd.h>
 
-struct Node;
-// typedef std::pair<Node *, int> Edge;
-typedef std::atomic<Node *> Edge;
+#include "nodePool.h"
+#include "fixedKey.h"
+#include "epochReclaimer.h"
+#include "spinLock.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Keys (and leaf values) are stored inline in the nodes, comparisons never chase a pointer.
+
+// The per-node lock is a one byte SpinLock, packed with the flags ahead of the key.
+template <typename K>
 struct Node
 {
     std::atomic<bool> removed;
     // std::atomic<int> sum;
-    std::mutex mtx;
-
-    int key;
+    SpinLock mtx;
     bool is_leaf;
 
-    Node(int k = -1, bool is_leaf = false) : key(k), is_leaf(is_leaf), removed(false) {}
+    K key;
+
+    Node(const K &k = K(), bool is_leaf = false) : removed(false), is_leaf(is_leaf), key(k) {}
 };
 
-struct LeafNode : Node
+template <typename K, typename V>
+struct LeafNode : Node<K>
 {
-    int value;
-    LeafNode(int k, int v) : Node(k, true), value(v) {}
+    std::atomic<V> value; // changed in place by LeafTree::insert_or_assign and update
+    LeafNode(const K &k, const V &v) : Node<K>(k, true), value(v) {}
 };
 
-struct InternalNode : Node
+template <typename K>
+struct InternalNode : Node<K>
 {
-    Edge child[2]; // [~, key), [key, ~)
-    InternalNode(int k = -1, Node *l = nullptr, Node *r = nullptr) : Node(k, false)
+    std::atomic<Node<K> *> child[2]; // [~, key), [key, ~)
+    std::atomic<unsigned long> version; // bumped under mtx whenever a child changes or the node is removed
+    InternalNode(const K &k = K(), Node<K> *l = nullptr, Node<K> *r = nullptr) : Node<K>(k, false), version(0)
     {
         child[0].store(l);
         child[1].store(r);
     }
 };
 
-// what is sentinal?
+template <typename K>
+struct AVLInternalNode;
+
+// height of a subtree of RelaxedAVLTree, leaves and null are 0
+template <typename K>
+int height_of(Node<K> *nd)
+{
+    return nd == nullptr || nd->is_leaf ? 0 : ((AVLInternalNode<K> *)nd)->height.load(std::memory_order_relaxed);
+}
+
+template <typename K>
+struct AVLInternalNode : InternalNode<K>
+{
+    std::atomic<unsigned char> height; // of the subtree, saturating
+    AVLInternalNode(const K &k = K(), Node<K> *l = nullptr, Node<K> *r = nullptr)
+        : InternalNode<K>(k, l, r), height(std::min(1 + std::max(height_of(l), height_of(r)), 255)) {}
+};
+
+template <typename K>
+struct LockFreeInternalNode : InternalNode<K>
+{
+    // update word for LockFreeLeafTree : UpdateInfo pointer | state in the low 2 bits
+    std::atomic<uintptr_t> update;
+    LockFreeInternalNode(const K &k = K(), Node<K> *l = nullptr, Node<K> *r = nullptr) : InternalNode<K>(k, l, r), update(0) {}
+};
+
+template <typename K>
+struct UpdateInfo
+{
+    // Info record (Ellen et al.), describes a pending insert or remove so that
+    // any thread that runs into the flag can finish it.
+    LockFreeInternalNode<K> *gp, *p;
+    int gp_dir, p_dir;
+    Node<K> *l;
+    LockFreeInternalNode<K> *new_internal; // insert : replaces l
+    uintptr_t pupdate;                     // remove : update word of p seen by find
+};
+
+// Allocation policy for tree nodes, Pool is NewAllocator or NodePool.
+// Node has no virtual destructor, so destroy() dispatches on is_leaf.
+// Internal is the internal node type of the tree, other types (info records) are destroyed as is.
+template <typename K, typename V, template <typename> class Pool = NodePool, typename Internal = InternalNode<K>>
+struct NodeAllocator
+{
+    typedef Internal InternalNode;
+
+    template <typename N, typename... Args>
+    static N *create(Args &&...args)
+    {
+        return Pool<N>::create(std::forward<Args>(args)...);
+    }
+    static void destroy(Node<K> *nd)
+    {
+        if (nd->is_leaf)
+            Pool<LeafNode<K, V>>::destroy((LeafNode<K, V> *)nd);
+        else
+            Pool<Internal>::destroy((Internal *)nd);
+    }
+    template <typename N>
+    static void destroy(N *nd)
+    {
+        Pool<N>::destroy(nd);
+    }
+};
+
+// Reclamation policies for removed nodes.
+// Every operation runs inside a Guard. Traversals publish the nodes they are about to
+// dereference with protect(), and remove() hands the unlinked parent and leaf to retire(),
+// which eventually gives them back to the Allocator.
+// EpochReclaimer (epochReclaimer.h) is shared with harrisList.cpp.
+
+template <typename T, typename Alloc>
+struct LeakReclaimer
+{
+    // removed nodes are never freed (original behavior)
+    typedef Alloc Allocator;
+    static const bool protects = false;
+    struct Guard
+    {
+        Guard(LeakReclaimer &) {}
+    };
+    void protect(int, T *) {}
+    template <typename U>
+    void retire(U *) {}
+};
+
+template <typename T, typename Alloc>
+struct HazardReclaimer
+{
+    // Hazard pointers (Michael).
+    // A retired node is freed by a scan only if no hazard pointer points at it.
+    // Protecting a node is only useful if it is revalidated as reachable after publishing,
+    // which is the caller's job (see LeafTree::find).
+    // Records are claimed per guard instead of per thread, like slots in an epoch reclaimer.
+    typedef Alloc Allocator;
+    static const bool protects = true;
+    static const int MAX_RECORDS = 128; // max concurrent guards
+    static const int HAZARDS = 3;       // gp, p, leaf
+    static const int SCAN_THRESHOLD = 2 * MAX_RECORDS * HAZARDS;
+
+    struct alignas(64) Record
+    {
+        std::atomic<bool> in_use{false};
+        std::atomic<T *> hazard[HAZARDS];
+        std::vector<T *> retired;
+        Record()
+        {
+            for (auto &h : hazard)
+                h.store(nullptr);
+        }
+    };
+
+    Record records[MAX_RECORDS];
+    static inline thread_local Record *held = nullptr;
+
+    ~HazardReclaimer()
+    {
+        for (auto &r : records)
+            for (T *node : r.retired)
+                Alloc::destroy(node);
+    }
+
+    struct Guard
+    {
+        HazardReclaimer &r;
+        Record *record;
+        Guard(HazardReclaimer &r) : r(r), record(r.enter()) {}
+        ~Guard() { r.exit(record); }
+    };
+
+    Record *enter()
+    {
+        static thread_local unsigned long hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+        int i = hint % MAX_RECORDS;
+        while (true)
+        {
+            bool expected = false;
+            if (!records[i].in_use.load(std::memory_order_relaxed) &&
+                records[i].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                break;
+            i = (i + 1) % MAX_RECORDS;
+        }
+        hint = i;
+        held = &records[i];
+        return held;
+    }
+
+    void exit(Record *r)
+    {
+        held = nullptr;
+        for (auto &h : r->hazard)
+            h.store(nullptr, std::memory_order_release);
+        r->in_use.store(false, std::memory_order_release);
+    }
+
+    // publish node in hazard slot i, caller must revalidate before dereferencing
+    void protect(int i, T *node)
+    {
+        held->hazard[i].store(node); // seq_cst, ordered before the revalidating loads
+    }
+
+    // must be called inside a guard, after the node is unreachable
+    void retire(T *node)
+    {
+        Record *r = held;
+        r->retired.push_back(node);
+        if (r->retired.size() >= SCAN_THRESHOLD)
+            scan(r);
+    }
+
+    void scan(Record *r)
+    {
+        std::vector<T *> hazards;
+        hazards.reserve(MAX_RECORDS * HAZARDS);
+        for (auto &rec : records)
+            for (auto &h : rec.hazard)
+            {
+                T *node = h.load();
+                if (node != nullptr)
+                    hazards.push_back(node);
+            }
+        std::sort(hazards.begin(), hazards.end());
+
+        std::vector<T *> remaining;
+        for (T *node : r->retired)
+        {
+            if (std::binary_search(hazards.begin(), hazards.end(), node))
+                remaining.push_back(node);
+            else
+                Alloc::destroy(node);
+        }
+        r->retired.swap(remaining);
+    }
+};
 
+// With the defaults (int keys and values, std::less<int>) comparisons compile to plain int compares.
+// KeyLimits<K>::max() is reserved as the sentinel key.
+template <typename K = int, typename V = int, typename Compare = std::less<K>,
+          typename Reclaimer = HazardReclaimer<Node<K>, NodeAllocator<K, V>>>
 struct LeafTree
 {
+    typedef ::Node<K> Node;
+    typedef ::LeafNode<K, V> LeafNode;
+    typedef typename Reclaimer::Allocator Allocator;
+    typedef typename Allocator::InternalNode InternalNode; // ::InternalNode<K>, or a subtype of it
+    typedef std::atomic<Node *> Edge;
+    typedef typename Reclaimer::Guard Guard;
+
+    const K MAX_KEY = KeyLimits<K>::max();
     InternalNode *root; // root does not have key, and will only have left child.
-    LeafTree() : root(new InternalNode()) {}
+    Reclaimer reclaimer;
+    Compare comp;
 
-    auto find(InternalNode *root, int key)
+    // sentinel leaf with MAX_KEY is never removed, so every real leaf has a grandparent
+    LeafTree() : root(Allocator::template create<InternalNode>(K(), Allocator::template create<LeafNode>(MAX_KEY, V()))) {}
+
+    // Bulk load from (key, value) pairs in [first, last), strictly increasing by Compare and
+    // without MAX_KEY. Builds a perfectly balanced tree in O(n), the top levels of the
+    // recursion split across thread_count threads. Not thread-safe with other operations.
+    template <typename It>
+    LeafTree(It first, It last, int thread_count = 1) : root(Allocator::template create<InternalNode>(K()))
     {
-        InternalNode *gp = nullptr;
-        int gp_dir = 1;
-        InternalNode *p = root;
-        int p_dir = 0;
-        Node *l = p->child[p_dir].load();
+        long n = last - first;
+        // where the sentinel goes among the input leaves
+        long sentinel = std::lower_bound(first, last, MAX_KEY, [&](const std::pair<K, V> &kv, const K &key)
+                                         { return comp(kv.first, key); }) -
+                        first;
+        assert(sentinel == n || comp(MAX_KEY, first[sentinel].first));
+        root->child[0].store(build(first, sentinel, 0, n + 1, thread_count));
+    }
 
-        while (!l->is_leaf)
+    ~LeafTree() // not thread-safe
+    {
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
         {
-            gp = p;
-            gp_dir = p_dir;
-            p = (InternalNode *)l;
-            p_dir = p->key <= key ? 1 : 0;
-            l = p->child[p_dir].load(); // LinP for failed insert/delete : last load
+            Node *nd = stack.back();
+            stack.pop_back();
+            if (!nd->is_leaf)
+            {
+                for (auto &c : ((InternalNode *)nd)->child)
+                    if (c.load() != nullptr)
+                        stack.push_back(c.load());
+            }
+            Allocator::destroy(nd);
         }
+    }
 
-        return std::make_tuple(gp, gp_dir, p, p_dir, (LeafNode *)l);
+    // load p->child[dir] and protect it in hazard slot i.
+    // returns nullptr if p was removed or the child changed, then the caller restarts.
+    Node *protect_child(InternalNode *p, int dir, int i)
+    {
+        Node *l = p->child[dir].load();
+        if (!Reclaimer::protects)
+            return l;
+        reclaimer.protect(i, l);
+        if (p->removed.load() || p->child[dir].load() != l)
+            return nullptr;
+        return l;
     }
 
-    bool insert(InternalNode *root, int key, int val)
+    bool equal(const K &a, const K &b)
     {
-        // Node *prev_leaf = nullptr; // for upsert
-        while (true)
+        return !comp(a, b) && !comp(b, a);
+    }
+
+    // Subtree over leaves [lo, hi) of the input with the sentinel spliced in at index sentinel.
+    // Every internal node splits its range in half and takes the first key of the right half.
+    template <typename It>
+    Node *build(It first, long sentinel, long lo, long hi, int thread_count)
+    {
+        if (hi - lo == 1)
         {
-            auto [gp, gp_dir, p, p_dir, leaf] = find(root, key);
-            if (leaf->key == key)
-                return false;
-            // prev_leaf = leaf;
+            if (lo == sentinel)
+                return Allocator::template create<LeafNode>(MAX_KEY, V());
+            auto &kv = first[lo < sentinel ? lo : lo - 1];
+            return Allocator::template create<LeafNode>(kv.first, kv.second);
+        }
+        long mid = lo + (hi - lo) / 2;
+        const K &key = mid == sentinel ? MAX_KEY : first[mid < sentinel ? mid : mid - 1].first;
+        Node *left, *right;
+        if (thread_count > 1)
+        {
+            // left half on a new thread, right half here
+            std::thread t([&]()
+                          { left = build(first, sentinel, lo, mid, thread_count / 2); });
+            right = build(first, sentinel, mid, hi, thread_count - thread_count / 2);
+            t.join();
+        }
+        else
+        {
+            left = build(first, sentinel, lo, mid, 1);
+            right = build(first, sentinel, mid, hi, 1);
+        }
+        return Allocator::template create<InternalNode>(key, left, right);
+    }
 
-            p->mtx.lock();
-            Edge *ptr = &(p->child[p_dir]); // desired location
-            if (p->removed.load() || ptr->load() != leaf)
+    static void debug_info()
+    {
+        std::cout << " --- Node Debug Info ---" << std::endl;
+        std::cout << "Leaf node size : " << sizeof(LeafNode) << ", pool block " << NodePool<LeafNode>::BLOCK_SIZE << std::endl;
+        std::cout << "Internal node size : " << sizeof(InternalNode) << ", pool block " << NodePool<InternalNode>::BLOCK_SIZE << std::endl;
+        std::cout << std::endl;
+        std::cout << "Node key size : " << sizeof(K) << std::endl;
+        std::cout << "Node value size : " << sizeof(V) << std::endl;
+        std::cout << "Node lock size : " << sizeof(SpinLock) << std::endl;
+        std::cout << " --- End of Node Debug Info ---" << std::endl
+                  << std::endl;
+    }
+
+    // Where a traversal for a key ended, with the versions of p and gp seen on the way down.
+    // slot[] are the hazard slots of gp, p and leaf.
+    struct Position
+    {
+        InternalNode *gp;
+        int gp_dir;
+        unsigned long gp_version;
+        InternalNode *p;
+        int p_dir;
+        unsigned long p_version;
+        LeafNode *leaf;
+        int gp_slot, p_slot, l_slot;
+    };
+
+    struct Stats
+    {
+        std::atomic<long> local_retries{0}; // resumed from p or gp
+        std::atomic<long> root_restarts{0}; // resumed from root
+    };
+    Stats stats;
+
+    // caller must hold a guard, gp / p / leaf stay protected until the guard ends
+    Position find(InternalNode *root, const K &key)
+    {
+        Position pos{nullptr, 1, 0, root, 0, 0, nullptr, 0, 1, 2};
+        descend(pos, key);
+        return pos;
+    }
+
+    // Continue a traversal from pos.p, which must be protected in pos.p_slot.
+    // The version of each internal node is read before its child, so a writer that later
+    // locks p (and gp) and finds the versions unchanged knows nothing moved in between.
+    // Without hazard pointers the walk may pass through an already removed node and read
+    // its final version, so writers check removed as well.
+    void descend(Position &pos, const K &key)
+    {
+        while (true)
+        {
+            pos.p_version = pos.p->version.load();
+            pos.p_dir = (pos.p == root || comp(key, pos.p->key)) ? 0 : 1; // root only has a left child
+            Node *l = protect_child(pos.p, pos.p_dir, pos.l_slot); // LinP for failed insert/delete : last load
+            if (l == nullptr)
             {
-                // p updated
-                p->mtx.unlock();
+                resume(pos); // lost a race with remove
                 continue;
             }
+            if (l->is_leaf)
+            {
+                pos.leaf = (LeafNode *)l;
+                return;
+            }
 
-            LeafNode *new_leaf_node = new LeafNode(key, val);
-            InternalNode *new_in_node =
-                (leaf->key < key)
-                    ? new InternalNode(key, leaf, new_leaf_node)
-                    : new InternalNode(leaf->key, new_leaf_node, leaf);
-            ptr->store(new_in_node); // LinP for success
+            // hazard slots rotate: the slot of the old gp is reused for the new leaf
+            pos.gp = pos.p;
+            pos.gp_dir = pos.p_dir;
+            pos.gp_version = pos.p_version;
+            pos.p = (InternalNode *)l;
+            std::swap(pos.gp_slot, pos.p_slot);
+            std::swap(pos.p_slot, pos.l_slot);
+        }
+    }
+
+    // Validation failed at pos. Resume from the nearest ancestor that is still in the tree
+    // instead of the root: p if it was not removed, else gp. Both are still protected, and a
+    // node that is still in the tree still covers key, since removes only widen key ranges.
+    // Resuming from gp loses its parent, which only matters when remove needs it.
+    void retry(Position &pos, const K &key)
+    {
+        resume(pos);
+        descend(pos, key);
+    }
+
+    void resume(Position &pos)
+    {
+        if (!pos.p->removed.load())
+        {
+            stats.local_retries.fetch_add(1, std::memory_order_relaxed);
+            if (pos.gp != nullptr)
+            {
+                // keep gp only if it still points to p, with a fresh version
+                pos.gp_version = pos.gp->version.load();
+                if (pos.gp->removed.load() || pos.gp->child[pos.gp_dir].load() != pos.p)
+                    pos.gp = nullptr;
+            }
+        }
+        else if (pos.gp != nullptr && !pos.gp->removed.load())
+        {
+            stats.local_retries.fetch_add(1, std::memory_order_relaxed);
+            pos.p = pos.gp;
+            pos.gp = nullptr;
+            std::swap(pos.gp_slot, pos.p_slot);
+        }
+        else
+        {
+            stats.root_restarts.fetch_add(1, std::memory_order_relaxed);
+            pos = Position{nullptr, 1, 0, root, 0, 0, nullptr, 0, 1, 2};
+        }
+    }
 
+    // Replace pos.leaf (which does not hold key) by an internal node over it and a new leaf.
+    // Returns false, with pos moved on by retry(), if p changed since the traversal.
+    bool link(Position &pos, const K &key, const V &val)
+    {
+        LeafNode *leaf = pos.leaf;
+        InternalNode *p = pos.p;
+        p->mtx.lock();
+        if (p->removed.load() || p->version.load() != pos.p_version)
+        {
+            // p updated (or removed)
             p->mtx.unlock();
-            return true;
+            retry(pos, key);
+            return false;
+        }
+
+        LeafNode *new_leaf_node = Allocator::template create<LeafNode>(key, val);
+        InternalNode *new_in_node =
+            comp(leaf->key, key)
+                ? Allocator::template create<InternalNode>(key, leaf, new_leaf_node)
+                : Allocator::template create<InternalNode>(leaf->key, new_leaf_node, leaf);
+        p->child[pos.p_dir].store(new_in_node); // LinP for success
+        p->version.fetch_add(1);
+
+        p->mtx.unlock();
+        return true;
+    }
+
+    bool insert(InternalNode *root, const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        Position pos = find(root, key);
+        while (true)
+        {
+            if (equal(pos.leaf->key, key))
+                return false;
+            if (link(pos, key, val))
+                return true;
         }
     };
 
-    bool remove(InternalNode *root, int key)
+    // Values are changed in place, without new nodes, under the leaf's lock. remove() flags
+    // the leaf under the same lock before unlinking it, so a leaf found unflagged under the
+    // lock is still in the tree, and the write is its LinP. A flagged leaf is never written,
+    // the key is looked up again. Readers load values without the lock.
+
+    // Sets the value of key, inserting it if absent. Returns true if key was inserted.
+    bool insert_or_assign(InternalNode *root, const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        Position pos = find(root, key);
+        while (true)
+        {
+            LeafNode *leaf = pos.leaf;
+            if (equal(leaf->key, key))
+            {
+                if (assign(leaf, [&](const V &)
+                           { return val; }))
+                    return false;
+                pos = find(root, key);
+                continue;
+            }
+            if (link(pos, key, val))
+                return true;
+        }
+    }
+
+    // Atomically replaces the value v of key by fn(v). Returns false if key is absent.
+    // fn is called exactly once if key is present, and not at all otherwise.
+    template <typename F>
+    bool update(InternalNode *root, const K &key, F fn)
+    {
+        Guard guard(reclaimer);
+        while (true)
+        {
+            LeafNode *leaf = find(root, key).leaf;
+            if (!equal(leaf->key, key))
+                return false;
+            if (assign(leaf, fn))
+                return true;
+        }
+    }
+
+    // value = fn(value) unless leaf was removed, returns whether it was written
+    template <typename F>
+    bool assign(LeafNode *leaf, F fn)
+    {
+        leaf->mtx.lock();
+        bool live = !leaf->removed.load();
+        if (live)
+            leaf->value.store(fn(leaf->value.load()));
+        leaf->mtx.unlock();
+        return live;
+    }
+
+    bool remove(InternalNode *root, const K &key)
     {
+        Guard guard(reclaimer);
         LeafNode *prev_leaf = nullptr;
+        Position pos = find(root, key);
         while (true)
         {
-            auto [gp, gp_dir, p, p_dir, leaf] = find(root, key);
-            if (leaf->key != key)
+            LeafNode *leaf = pos.leaf;
+            if (!equal(leaf->key, key))
                 return false; // key not found
             if (prev_leaf != nullptr && prev_leaf != leaf)
                 return false; // key deleted and re-added
             prev_leaf = leaf;
-
-            gp->mtx.lock();
-            p->mtx.lock();
-            Edge *ptr = &(gp->child[gp_dir]);
-            if (gp->removed.load() || ptr->load() != p)
+            if (pos.gp == nullptr)
             {
-                gp->mtx.unlock();
-                p->mtx.unlock();
+                // resumed from gp and landed right below it, its parent is unknown
+                stats.root_restarts.fetch_add(1, std::memory_order_relaxed);
+                pos = find(root, key);
                 continue;
             }
-            Node *remaining_leaf = p->child[1 - p_dir].load();
-            Node *target_leaf = p->child[p_dir].load();
-            if (target_leaf != leaf)
+
+            InternalNode *gp = pos.gp, *p = pos.p;
+            gp->mtx.lock();
+            p->mtx.lock();
+            if (gp->removed.load() || gp->version.load() != pos.gp_version || p->version.load() != pos.p_version)
             {
                 gp->mtx.unlock();
                 p->mtx.unlock();
+                retry(pos, key);
                 continue;
             }
 
+            // unlink before flagging p, so traversals never see p removed while gp still
+            // points to it (they would fail validation until the store below).
+            // The leaf is flagged first, under its lock, see insert_or_assign().
+            leaf->mtx.lock();
+            leaf->removed.store(true);
+            leaf->mtx.unlock();
+            Node *remaining_leaf = p->child[1 - pos.p_dir].load();
+            gp->child[pos.gp_dir].store(remaining_leaf); // LinP for success
+            gp->version.fetch_add(1);
             p->removed.store(true);
-            ptr->store(remaining_leaf); // LinP for success
-
-            // TODO remove nodes
-            // delete p;
-            // delete l;
+            p->version.fetch_add(1);
 
             gp->mtx.unlock();
             p->mtx.unlock();
+
+            reclaimer.retire(p);
+            reclaimer.retire(leaf);
             return true;
         }
     }
 
-    bool search(InternalNode *root, int key)
+    bool search(InternalNode *root, const K &key)
     {
-        Node *nd = root->child[0].load();
-        while (!nd->is_leaf)
+        Guard guard(reclaimer);
+        while (true)
+        {
+            int p_slot = 0, nd_slot = 1;
+            Node *nd = protect_child(root, 0, nd_slot);
+            while (nd != nullptr && !nd->is_leaf)
+            {
+                std::swap(p_slot, nd_slot);
+                int dir = comp(key, nd->key) ? 0 : 1;
+                nd = protect_child((InternalNode *)nd, dir, nd_slot); // LinP : last load
+            }
+            if (nd == nullptr)
+                continue;
+
+            auto leaf = (LeafNode *)nd;
+            return equal(leaf->key, key);
+        }
+    }
+
+    // Ordered range scan. Copies the (key, value) pairs with lo <= key <= hi into out, in
+    // increasing order, and stops after cap of them. Returns how many were written.
+    // With include_lo = false, lo itself is skipped, so the next page starts from
+    // scan(root, last key, hi, out, cap, false).
+    //
+    // The scan is weakly consistent, not a snapshot. It takes no locks, so writers never wait
+    // on it. Every key in range that is in the tree for the whole scan is returned. A key
+    // inserted or removed during the scan may or may not be returned. Every returned pair was
+    // in the tree at some point during the scan, and keys come out strictly increasing with no
+    // duplicates, even when a key is removed and re-added behind the scan.
+    //
+    // If the reclaimer does not protect single nodes (leak, epoch), this is an in-order walk
+    // with an explicit stack. Hazard pointers cannot hold a stack of nodes, so each next leaf
+    // is found with a successor search from the root instead, which costs O(depth) per key.
+    int scan(InternalNode *root, const K &lo, const K &hi, std::pair<K, V> *out, int cap, bool include_lo = true)
+    {
+        Guard guard(reclaimer);
+        if constexpr (Reclaimer::protects)
+        {
+            int count = 0;
+            K from = lo;
+            bool inclusive = include_lo;
+            while (count < cap)
+            {
+                LeafNode *leaf = successor(root, from, inclusive);
+                if (leaf == nullptr || comp(hi, leaf->key))
+                    break;
+                from = leaf->key;
+                inclusive = false;
+                if (!equal(leaf->key, MAX_KEY))
+                    out[count++] = {leaf->key, leaf->value};
+            }
+            return count;
+        }
+        else
+        {
+            int count = 0;
+            std::vector<Node *> stack = {root->child[0].load()}; // right subtrees still to visit
+            while (!stack.empty() && count < cap)
+            {
+                Node *nd = stack.back();
+                stack.pop_back();
+                while (nd != nullptr && !nd->is_leaf)
+                {
+                    // left subtree holds keys below nd->key, right subtree the rest
+                    InternalNode *in = (InternalNode *)nd;
+                    bool left = comp(lo, in->key), right = !comp(hi, in->key);
+                    if (left && right)
+                        stack.push_back(in->child[1].load());
+                    nd = left ? in->child[0].load() : right ? in->child[1].load() : nullptr;
+                }
+                if (nd == nullptr)
+                    continue;
+
+                LeafNode *leaf = (LeafNode *)nd;
+                bool above_lo = include_lo ? !comp(leaf->key, lo) : comp(lo, leaf->key);
+                bool after_last = count == 0 || comp(out[count - 1].first, leaf->key); // stale subtrees can repeat a key
+                if (above_lo && !comp(hi, leaf->key) && after_last && !equal(leaf->key, MAX_KEY))
+                    out[count++] = {leaf->key, leaf->value};
+            }
+            return count;
+        }
+    }
+
+    // Leaf with the smallest key >= key (> key if not inclusive), nullptr if there is none.
+    // Caller must hold a guard, the leaf stays protected until the next call.
+    LeafNode *successor(InternalNode *root, const K &key, bool inclusive)
+    {
+        const int cand_slot = 2;
+        while (true)
         {
-            auto nd_child = ((InternalNode *)nd)->child;
-            Edge *ptr = (key < nd->key) ? &(nd_child[0]) : &(nd_child[1]);
-            nd = ptr->load(); // LinP : last load
+            // cand : deepest node where the search went left, its right subtree is next in order
+            InternalNode *cand = nullptr;
+            int p_slot = 0, nd_slot = 1;
+            Node *nd = protect_child(root, 0, nd_slot);
+            while (nd != nullptr && !nd->is_leaf)
+            {
+                std::swap(p_slot, nd_slot);
+                InternalNode *p = (InternalNode *)nd;
+                int dir = comp(key, p->key) ? 0 : 1;
+                if (dir == 0)
+                {
+                    cand = p;
+                    reclaimer.protect(cand_slot, p); // still protected in p_slot, nothing to revalidate
+                }
+                nd = protect_child(p, dir, nd_slot);
+            }
+            if (nd == nullptr)
+                continue;
+
+            LeafNode *leaf = (LeafNode *)nd;
+            if (inclusive ? !comp(leaf->key, key) : comp(key, leaf->key))
+                return leaf;
+            if (cand == nullptr)
+                return nullptr;
+
+            // leftmost leaf of cand's right subtree, all of its keys are above key
+            nd = protect_child(cand, 1, nd_slot);
+            while (nd != nullptr && !nd->is_leaf)
+            {
+                std::swap(p_slot, nd_slot);
+                nd = protect_child((InternalNode *)nd, 0, nd_slot);
+            }
+            if (nd != nullptr)
+                return (LeafNode *)nd;
         }
+    }
 
-        auto leaf = (LeafNode *)nd;
-        return leaf->key == key;
+    int depth() // not thread-safe, deepest leaf
+    {
+        int d = 0;
+        std::vector<std::pair<Node *, int>> stack = {{root->child[0].load(), 1}};
+        while (!stack.empty())
+        {
+            auto [nd, nd_depth] = stack.back();
+            stack.pop_back();
+            d = std::max(d, nd_depth);
+            if (!nd->is_leaf)
+                for (auto &c : ((InternalNode *)nd)->child)
+                    stack.push_back({c.load(), nd_depth + 1});
+        }
+        return d;
     }
 };
+
+// LeafTree with relaxed AVL balance (Larsen; Bouge et al.).
+// Updates are LeafTree's, rebalancing is decoupled from them : after its update, a thread
+// walks the path of its key bottom up, from the deepest node whose height is stale or whose
+// children differ in height by more than one. Each step locks one node (and its parent),
+// refreshes its height or rotates it, and the walk stops at the first node it leaves unchanged.
+// Between steps the tree may be out of balance, but once updates stop every path is fixed.
+//
+// Rotations never modify a node that readers may be on : the rotated nodes are replaced by
+// fresh copies and marked removed, like the parent in LeafTree::remove, so unlocked searches
+// and scans still end at the right leaf and writers holding a stale position fail validation.
+// The walk holds a whole path, so it needs a reclaimer that does not protect single nodes.
+template <typename K = int, typename V = int, typename Compare = std::less<K>,
+          typename Reclaimer = EpochReclaimer<Node<K>, NodeAllocator<K, V, NodePool, AVLInternalNode<K>>>>
+struct RelaxedAVLTree : LeafTree<K, V, Compare, Reclaimer>
+{
+    typedef LeafTree<K, V, Compare, Reclaimer> Base;
+    typedef typename Base::Node Node;
+    typedef typename Base::InternalNode InternalNode;
+    typedef typename Base::Guard Guard;
+    typedef typename Base::Allocator Allocator;
+
+    static_assert(!Reclaimer::protects, "rebalancing holds a whole path, which hazard pointers cannot protect");
+    static_assert(std::is_base_of<AVLInternalNode<K>, InternalNode>::value, "internal nodes must carry a height");
+
+    enum Step
+    {
+        UNCHANGED, // n was balanced and its height was right
+        CHANGED,   // n got a new height, or was rotated
+        RETRY      // n or its parent were replaced
+    };
+
+    std::atomic<long> rotations{0};
+
+    using Base::Base;
+
+    bool insert(InternalNode *root, const K &key, const V &val)
+    {
+        if (!Base::insert(root, key, val))
+            return false;
+        rebalance(root, key);
+        return true;
+    }
+
+    bool insert_or_assign(InternalNode *root, const K &key, const V &val)
+    {
+        if (!Base::insert_or_assign(root, key, val))
+            return false;
+        rebalance(root, key);
+        return true;
+    }
+
+    bool remove(InternalNode *root, const K &key)
+    {
+        if (!Base::remove(root, key))
+            return false;
+        rebalance(root, key);
+        return true;
+    }
+
+    static bool balanced(InternalNode *nd)
+    {
+        int hl = height_of(nd->child[0].load()), hr = height_of(nd->child[1].load());
+        return hl - hr <= 1 && hr - hl <= 1 && nd->height.load(std::memory_order_relaxed) == std::min(1 + std::max(hl, hr), 255);
+    }
+
+    void rebalance(InternalNode *root, const K &key)
+    {
+        Guard guard(this->reclaimer);
+        static thread_local std::vector<InternalNode *> path; // root first
+        while (true)
+        {
+            path.clear();
+            for (Node *nd = root; !nd->is_leaf;)
+            {
+                auto in = (InternalNode *)nd;
+                path.push_back(in);
+                nd = in->child[in == root ? 0 : dir(in, key)].load();
+            }
+
+            // the deepest node the last update left out of balance, if any
+            int i = path.size() - 1;
+            while (i >= 1 && balanced(path[i]))
+                i--;
+
+            Step step = CHANGED;
+            for (; i >= 1 && step == CHANGED; i--)
+                step = fix(path[i - 1], path[i - 1] == root ? 0 : dir(path[i - 1], key), path[i]);
+            if (step != RETRY)
+                return;
+        }
+    }
+
+    int dir(InternalNode *in, const K &key)
+    {
+        return this->comp(key, in->key) ? 0 : 1;
+    }
+
+    // Refresh the height of n, or rotate it if one side is taller by more than one.
+    Step fix(InternalNode *f, int f_dir, InternalNode *n)
+    {
+        f->mtx.lock();
+        n->mtx.lock();
+        if (f->removed.load() || n->removed.load() || f->child[f_dir].load() != n)
+        {
+            n->mtx.unlock();
+            f->mtx.unlock();
+            return RETRY;
+        }
+
+        int h[2] = {height_of(n->child[0].load()), height_of(n->child[1].load())};
+        if (h[0] - h[1] <= 1 && h[1] - h[0] <= 1)
+        {
+            unsigned char height = std::min(1 + std::max(h[0], h[1]), 255);
+            Step step = n->height.load() == height ? UNCHANGED : CHANGED;
+            n->height.store(height);
+            n->mtx.unlock();
+            f->mtx.unlock();
+            return step;
+        }
+
+        // heavy side s, its child c is internal since it is at least 2 high
+        int s = h[0] > h[1] ? 0 : 1;
+        auto c = (InternalNode *)n->child[s].load();
+        c->mtx.lock();
+        Node *outer = c->child[s].load(), *inner = c->child[1 - s].load();
+        Node *top;
+        InternalNode *m = nullptr;
+        if (height_of(outer) >= height_of(inner))
+        {
+            // single rotation, c goes up and n takes its inner child
+            Node *n_kids[2], *c_kids[2];
+            n_kids[s] = inner;
+            n_kids[1 - s] = n->child[1 - s].load();
+            c_kids[s] = outer;
+            c_kids[1 - s] = Allocator::template create<InternalNode>(n->key, n_kids[0], n_kids[1]);
+            top = Allocator::template create<InternalNode>(c->key, c_kids[0], c_kids[1]);
+        }
+        else
+        {
+            // double rotation, the inner grandchild m goes up and splits its children
+            m = (InternalNode *)inner;
+            m->mtx.lock();
+            Node *c_kids[2], *n_kids[2], *m_kids[2];
+            c_kids[s] = outer;
+            c_kids[1 - s] = m->child[s].load();
+            n_kids[s] = m->child[1 - s].load();
+            n_kids[1 - s] = n->child[1 - s].load();
+            m_kids[s] = Allocator::template create<InternalNode>(c->key, c_kids[0], c_kids[1]);
+            m_kids[1 - s] = Allocator::template create<InternalNode>(n->key, n_kids[0], n_kids[1]);
+            top = Allocator::template create<InternalNode>(m->key, m_kids[0], m_kids[1]);
+        }
+
+        f->child[f_dir].store(top);
+        f->version.fetch_add(1);
+        for (InternalNode *old : {n, c, m})
+        {
+            if (old == nullptr)
+                continue;
+            old->removed.store(true);
+            old->version.fetch_add(1);
+        }
+        if (m != nullptr)
+            m->mtx.unlock();
+        c->mtx.unlock();
+        n->mtx.unlock();
+        f->mtx.unlock();
+
+        this->reclaimer.retire(n);
+        this->reclaimer.retire(c);
+        if (m != nullptr)
+            this->reclaimer.retire(m);
+        rotations.fetch_add(1, std::memory_order_relaxed);
+        return CHANGED;
+    }
+};
+
+// Non-blocking external BST (Ellen, Fatourou, Ruppert, van Breugel).
+// Same shape and API as LeafTree, but instead of locking p (and gp), an update first flags
+// the update word of the node it will change with an info record (IFLAG on p for insert,
+// DFLAG on gp then MARK on p for remove), then swings the child pointer with a CAS.
+// A thread that finds a flagged node helps the pending update finish before retrying,
+// so a descheduled thread never blocks the others.
+template <typename K = int, typename V = int, typename Compare = std::less<K>,
+          typename Reclaimer = EpochReclaimer<Node<K>, NodeAllocator<K, V, NodePool, LockFreeInternalNode<K>>>>
+struct LockFreeLeafTree
+{
+    typedef ::Node<K> Node;
+    typedef ::LeafNode<K, V> LeafNode;
+    typedef LockFreeInternalNode<K> InternalNode;
+    typedef UpdateInfo<K> Info;
+    typedef uintptr_t Update;
+    typedef std::atomic<Node *> Edge;
+    typedef typename Reclaimer::Guard Guard;
+    typedef typename Reclaimer::Allocator Allocator;
+
+    // helpers dereference info records and the nodes in them, which hazard slots do not cover
+    static_assert(!Reclaimer::protects, "LockFreeLeafTree needs an epoch (or leak) reclaimer");
+
+    enum State
+    {
+        CLEAN = 0,
+        DFLAG = 1,
+        IFLAG = 2,
+        MARK = 3
+    };
+
+    const K MAX_KEY = KeyLimits<K>::max();
+    InternalNode *root; // root does not have key, and will only have left child.
+    Reclaimer reclaimer;
+    Compare comp;
+
+    // sentinel leaf with MAX_KEY is never removed, so every real leaf has a grandparent
+    LockFreeLeafTree() : root(Allocator::template create<InternalNode>(K(), Allocator::template create<LeafNode>(MAX_KEY, V()))) {}
+
+    ~LockFreeLeafTree() // not thread-safe
+    {
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            if (!nd->is_leaf)
+            {
+                for (auto &c : ((InternalNode *)nd)->child)
+                    if (c.load() != nullptr)
+                        stack.push_back(c.load());
+                if (info(((InternalNode *)nd)->update.load()) != nullptr)
+                    Allocator::destroy(info(((InternalNode *)nd)->update.load()));
+            }
+            Allocator::destroy(nd);
+        }
+    }
+
+    static State state(Update u)
+    {
+        return (State)(u & 3);
+    }
+    static Info *info(Update u)
+    {
+        return (Info *)(u & ~(Update)3);
+    }
+    static Update flag(Info *op, State st)
+    {
+        return (Update)op | st;
+    }
+
+    bool equal(const K &a, const K &b)
+    {
+        return !comp(a, b) && !comp(b, a);
+    }
+
+    // caller must hold a guard.
+    // update words are read before the child pointers below them, as in the paper.
+    auto find(InternalNode *root, const K &key)
+    {
+        InternalNode *gp = nullptr;
+        int gp_dir = 1;
+        Update gpupdate = 0;
+        InternalNode *p = root;
+        int p_dir = 0;
+        Update pupdate = p->update.load();
+        Node *l = p->child[p_dir].load();
+
+        while (!l->is_leaf)
+        {
+            gp = p;
+            gp_dir = p_dir;
+            gpupdate = pupdate;
+            p = (InternalNode *)l;
+            p_dir = comp(key, p->key) ? 0 : 1;
+            pupdate = p->update.load();
+            l = p->child[p_dir].load();
+        }
+        return std::make_tuple(gp, gp_dir, p, p_dir, (LeafNode *)l, gpupdate, pupdate);
+    }
+
+    bool insert(InternalNode *root, const K &key, const V &val)
+    {
+        Guard guard(reclaimer);
+        while (true)
+        {
+            auto [gp, gp_dir, p, p_dir, leaf, gpupdate, pupdate] = find(root, key);
+            if (equal(leaf->key, key))
+                return false;
+            if (state(pupdate) != CLEAN)
+            {
+                help(pupdate);
+                continue;
+            }
+
+            // the old leaf is copied rather than reused, so a child CAS never sees it again (ABA)
+            LeafNode *new_leaf_node = Allocator::template create<LeafNode>(key, val);
+            LeafNode *sibling = Allocator::template create<LeafNode>(leaf->key, leaf->value);
+            InternalNode *new_in_node =
+                comp(leaf->key, key)
+                    ? Allocator::template create<InternalNode>(key, sibling, new_leaf_node)
+                    : Allocator::template create<InternalNode>(leaf->key, new_leaf_node, sibling);
+            Info *op = Allocator::template create<Info>();
+            op->p = p;
+            op->p_dir = p_dir;
+            op->l = leaf;
+            op->new_internal = new_in_node;
+
+            Update expected = pupdate;
+            if (p->update.compare_exchange_strong(expected, flag(op, IFLAG))) // iflag
+            {
+                retire_info(pupdate);
+                help_insert(op); // LinP for success : child CAS
+                reclaimer.retire(leaf);
+                return true;
+            }
+
+            // never published
+            Allocator::destroy(op);
+            Allocator::destroy(new_in_node);
+            Allocator::destroy(new_leaf_node);
+            Allocator::destroy(sibling);
+            help(expected);
+        }
+    }
+
+    bool remove(InternalNode *root, const K &key)
+    {
+        Guard guard(reclaimer);
+        while (true)
+        {
+            auto [gp, gp_dir, p, p_dir, leaf, gpupdate, pupdate] = find(root, key);
+            if (!equal(leaf->key, key))
+                return false; // key not found
+            if (state(gpupdate) != CLEAN)
+            {
+                help(gpupdate);
+                continue;
+            }
+            if (state(pupdate) != CLEAN)
+            {
+                help(pupdate);
+                continue;
+            }
+
+            Info *op = Allocator::template create<Info>();
+            op->gp = gp;
+            op->gp_dir = gp_dir;
+            op->p = p;
+            op->p_dir = p_dir;
+            op->l = leaf;
+            op->pupdate = pupdate;
+
+            Update expected = gpupdate;
+            if (gp->update.compare_exchange_strong(expected, flag(op, DFLAG))) // dflag
+            {
+                retire_info(gpupdate);
+                bool done = help_delete(op);
+                if (done)
+                {
+                    reclaimer.retire((Node *)p);
+                    reclaimer.retire((Node *)leaf);
+                    return true;
+                }
+                continue; // p changed before it could be marked
+            }
+
+            Allocator::destroy(op); // never published
+            help(expected);
+        }
+    }
+
+    bool search(InternalNode *root, const K &key)
+    {
+        Guard guard(reclaimer);
+        Node *nd = root->child[0].load();
+        while (!nd->is_leaf)
+        {
+            int dir = comp(key, nd->key) ? 0 : 1;
+            nd = ((InternalNode *)nd)->child[dir].load(); // LinP : last load
+        }
+        return equal(nd->key, key);
+    }
+
+    // An info record stays in the update word after its operation is done (as CLEAN), and
+    // a later find may still read that word and CAS against it. It is retired by whoever
+    // replaces it with a successful flag or mark CAS, never earlier : a freed record's block
+    // would come back from the pool as a new record, and an old update word would match again.
+    // A record still in a word when its node is retired is in the tree's last word for it
+    // (gp for a remove), so the next flag on that word retires it.
+    void retire_info(Update u)
+    {
+        if (info(u) != nullptr)
+            reclaimer.retire(info(u));
+    }
+
+    void help(Update u)
+    {
+        switch (state(u))
+        {
+        case IFLAG:
+            help_insert(info(u));
+            break;
+        case MARK:
+            help_marked(info(u));
+            break;
+        case DFLAG:
+            help_delete(info(u));
+            break;
+        default:
+            break;
+        }
+    }
+
+    void help_insert(Info *op)
+    {
+        cas_child(op->p, op->p_dir, op->l, op->new_internal);
+        Update expected = flag(op, IFLAG);
+        op->p->update.compare_exchange_strong(expected, flag(op, CLEAN)); // iunflag
+    }
+
+    // returns false if p changed since find, then gp is unflagged and the remove retries
+    bool help_delete(Info *op)
+    {
+        Update expected = op->pupdate;
+        if (op->p->update.compare_exchange_strong(expected, flag(op, MARK))) // mark
+        {
+            retire_info(op->pupdate);
+            help_marked(op);
+            return true;
+        }
+        if (expected == flag(op, MARK))
+        {
+            help_marked(op);
+            return true;
+        }
+        help(expected);
+        Update flagged = flag(op, DFLAG);
+        op->gp->update.compare_exchange_strong(flagged, flag(op, CLEAN)); // backtrack
+        return false;
+    }
+
+    void help_marked(Info *op)
+    {
+        // p is marked, so its children are frozen
+        Node *other = op->p->child[1 - op->p_dir].load();
+        cas_child(op->gp, op->gp_dir, op->p, other);
+        Update expected = flag(op, DFLAG);
+        op->gp->update.compare_exchange_strong(expected, flag(op, CLEAN)); // dunflag
+    }
+
+    void cas_child(InternalNode *parent, int dir, Node *old_node, Node *new_node)
+    {
+        parent->child[dir].compare_exchange_strong(old_node, new_node);
+    }
+};
+
+// Search within a sorted node: number of keys[0, count) before key (lower), or not after it (upper).
+// count may be read while a writer is changing the node, so it is clamped to N.
+template <typename K, typename Compare, int N>
+struct NodeSearch
+{
+    static int lower(const K *keys, int count, const K &key, const Compare &comp)
+    {
+        count = std::min(std::max(count, 0), N);
+        return std::lower_bound(keys, keys + count, key, comp) - keys;
+    }
+    static int upper(const K *keys, int count, const K &key, const Compare &comp)
+    {
+        count = std::min(std::max(count, 0), N);
+        return std::upper_bound(keys, keys + count, key, comp) - keys;
+    }
+};
+
+#if defined(__SSE2__)
+template <int N>
+struct NodeSearch<int, std::less<int>, N>
+{
+    // SSE2: compare key against 4 keys per instruction and count the hits,
+    // which for a sorted node is the same as the binary search but without branches.
+    static_assert(N % 4 == 0 && N <= 32, "keys are compared in blocks of 4, bits of one mask");
+
+    static int lower(const int *keys, int count, int key, const std::less<int> &)
+    {
+        return __builtin_popcount(mask(keys, key, true) & valid(count)); // keys[i] < key
+    }
+    static int upper(const int *keys, int count, int key, const std::less<int> &)
+    {
+        unsigned v = valid(count);
+        return __builtin_popcount(v) - __builtin_popcount(mask(keys, key, false) & v); // keys[i] <= key
+    }
+
+    // bit i : keys[i] < key if less, keys[i] > key otherwise
+    static unsigned mask(const int *keys, int key, bool less)
+    {
+        __m128i k = _mm_set1_epi32(key);
+        unsigned bits = 0;
+        for (int i = 0; i < N; i += 4)
+        {
+            __m128i block = _mm_load_si128((const __m128i *)(keys + i));
+            __m128i hit = less ? _mm_cmplt_epi32(block, k) : _mm_cmpgt_epi32(block, k);
+            bits |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(hit)) << i;
+        }
+        return bits;
+    }
+    static unsigned valid(int count)
+    {
+        count = std::min(std::max(count, 0), N);
+        return count >= 32 ? ~0u : (1u << count) - 1;
+    }
+};
+#endif
+
+struct BNode
+{
+    VersionLock lock;
+    int count; // keys in use
+    bool is_leaf;
+    BNode(bool is_leaf) : count(0), is_leaf(is_leaf) {}
+};
+
+template <typename K, typename V, int N>
+struct BLeafNode : BNode
+{
+    alignas(CACHE_LINE) K keys[N]; // 16 int keys are exactly one cache line
+    V values[N];
+    BLeafNode() : BNode(true) {}
+};
+
+template <typename K, int N>
+struct BInnerNode : BNode
+{
+    alignas(CACHE_LINE) K keys[N];
+    BNode *children[N + 1]; // children[i] holds [keys[i - 1], keys[i])
+    BInnerNode() : BNode(false) {}
+};
+
+// Concurrent B+-tree with fat nodes and optimistic lock coupling (Leis et al.), same API as LeafTree.
+// A lookup costs about log_N(n) cache misses instead of log2(n), and the key search inside
+// a node is one SIMD pass for int keys.
+// Readers lock nothing: they validate each node's version after reading it and restart from
+// the root if a writer got in between, so a read may see a node mid-update but never acts on it.
+// There are no B-link right pointers, so a descent that raced with a split always restarts.
+// Writers descend the same way and only lock the leaf they change, plus its parent to split.
+// Full nodes are split on the way down, so a split never has to go back up the tree.
+// remove() does not merge underfull nodes, and nodes are only freed with the tree, so the
+// optimistic readers need no reclamation scheme.
+template <typename K = int, typename V = int, typename Compare = std::less<K>, int N = 16,
+          template <typename> class Pool = NodePool>
+struct OLCBTree
+{
+    typedef BNode Node;
+    typedef BLeafNode<K, V, N> LeafNode;
+    typedef BInnerNode<K, N> InternalNode;
+    typedef NodeSearch<K, Compare, N> Search;
+
+    InternalNode *root; // root does not have key, and will only have left child (the top node).
+    Compare comp;
+
+    OLCBTree() : root(Pool<InternalNode>::create())
+    {
+        root->children[0] = Pool<LeafNode>::create();
+    }
+
+    ~OLCBTree() // not thread-safe
+    {
+        std::vector<Node *> stack = {root};
+        while (!stack.empty())
+        {
+            Node *nd = stack.back();
+            stack.pop_back();
+            if (nd->is_leaf)
+            {
+                Pool<LeafNode>::destroy((LeafNode *)nd);
+                continue;
+            }
+            InternalNode *in = (InternalNode *)nd;
+            for (int i = 0; i <= in->count; i++)
+                stack.push_back(in->children[i]);
+            Pool<InternalNode>::destroy(in);
+        }
+    }
+
+    bool equal(const K &a, const K &b)
+    {
+        return !comp(a, b) && !comp(b, a);
+    }
+
+    bool insert(InternalNode *root, const K &key, const V &val)
+    {
+        while (true)
+        {
+            InternalNode *parent = root;
+            uint64_t parent_version = parent->lock.read_lock();
+            Node *nd = parent->children[0];
+            uint64_t version = nd->lock.read_lock();
+            if (!parent->lock.validate(parent_version))
+                continue;
+            bool restart = false;
+
+            while (!nd->is_leaf)
+            {
+                InternalNode *in = (InternalNode *)nd;
+                if (in->count == N)
+                {
+                    split(parent, parent_version, nd, version);
+                    restart = true;
+                    break;
+                }
+                parent = in;
+                parent_version = version;
+                nd = in->children[Search::upper(in->keys, in->count, key, comp)];
+                version = nd->lock.read_lock();
+                if (!in->lock.validate(parent_version))
+                {
+                    restart = true;
+                    break;
+                }
+            }
+            if (restart)
+                continue;
+
+            LeafNode *leaf = (LeafNode *)nd;
+            if (leaf->count == N)
+            {
+                split(parent, parent_version, nd, version);
+                continue;
+            }
+            if (!leaf->lock.upgrade(version))
+                continue;
+
+            int pos = Search::lower(leaf->keys, leaf->count, key, comp);
+            if (pos < leaf->count && equal(leaf->keys[pos], key))
+            {
+                leaf->lock.unlock();
+                return false;
+            }
+            for (int i = leaf->count; i > pos; i--)
+            {
+                leaf->keys[i] = leaf->keys[i - 1];
+                leaf->values[i] = leaf->values[i - 1];
+            }
+            leaf->keys[pos] = key;
+            leaf->values[pos] = val;
+            leaf->count += 1; // LinP for success : unlock publishes it
+            leaf->lock.unlock();
+            return true;
+        }
+    }
+
+    bool remove(InternalNode *root, const K &key)
+    {
+        while (true)
+        {
+            uint64_t version;
+            LeafNode *leaf = find(root, key, version);
+            if (leaf == nullptr)
+                continue;
+            if (!leaf->lock.upgrade(version))
+                continue;
+
+            int pos = Search::lower(leaf->keys, leaf->count, key, comp);
+            if (pos == leaf->count || !equal(leaf->keys[pos], key))
+            {
+                leaf->lock.unlock();
+                return false;
+            }
+            for (int i = pos; i < leaf->count - 1; i++)
+            {
+                leaf->keys[i] = leaf->keys[i + 1];
+                leaf->values[i] = leaf->values[i + 1];
+            }
+            leaf->count -= 1; // underfull leaves are left as they are
+            leaf->lock.unlock();
+            return true;
+        }
+    }
+
+    bool search(InternalNode *root, const K &key)
+    {
+        while (true)
+        {
+            uint64_t version;
+            LeafNode *leaf = find(root, key, version);
+            if (leaf == nullptr)
+                continue;
+            int pos = Search::lower(leaf->keys, leaf->count, key, comp);
+            bool found = pos < leaf->count && equal(leaf->keys[pos], key);
+            if (leaf->lock.validate(version)) // LinP : validated read
+                return found;
+        }
+    }
+
+    // Optimistic descent to the leaf for key, returns nullptr if a validation failed.
+    // Each child's version is read before its parent is validated: a split of the child locks
+    // the parent too, so it either shows up in the parent's version or in the child's one.
+    // Validating the parent first would leave a gap where the child splits unnoticed and key
+    // moves to its new right sibling, which this tree has no link to follow.
+    LeafNode *find(InternalNode *root, const K &key, uint64_t &version)
+    {
+        uint64_t parent_version = root->lock.read_lock();
+        Node *nd = root->children[0];
+        version = nd->lock.read_lock();
+        if (!root->lock.validate(parent_version))
+            return nullptr;
+
+        while (!nd->is_leaf)
+        {
+            InternalNode *in = (InternalNode *)nd;
+            parent_version = version;
+            nd = in->children[Search::upper(in->keys, in->count, key, comp)];
+            version = nd->lock.read_lock();
+            if (!in->lock.validate(parent_version))
+                return nullptr;
+        }
+        return (LeafNode *)nd;
+    }
+
+    // Split the full node nd under parent, both read at the given versions.
+    // Gives up silently if either changed meanwhile, the caller restarts either way.
+    void split(InternalNode *parent, uint64_t parent_version, Node *nd, uint64_t version)
+    {
+        if (!parent->lock.upgrade(parent_version))
+            return;
+        if (!nd->lock.upgrade(version))
+        {
+            parent->lock.unlock();
+            return;
+        }
+
+        K sep;
+        Node *right;
+        if (nd->is_leaf)
+        {
+            LeafNode *left = (LeafNode *)nd, *new_leaf = Pool<LeafNode>::create();
+            int mid = N / 2;
+            new_leaf->count = N - mid;
+            std::copy(left->keys + mid, left->keys + N, new_leaf->keys);
+            std::copy(left->values + mid, left->values + N, new_leaf->values);
+            left->count = mid;
+            sep = new_leaf->keys[0];
+            right = new_leaf;
+        }
+        else
+        {
+            InternalNode *left = (InternalNode *)nd, *new_in = Pool<InternalNode>::create();
+            int mid = N / 2;
+            new_in->count = N - mid - 1;
+            std::copy(left->keys + mid + 1, left->keys + N, new_in->keys);
+            std::copy(left->children + mid + 1, left->children + N + 1, new_in->children);
+            left->count = mid;
+            sep = left->keys[mid];
+            right = new_in;
+        }
+
+        if (parent == root)
+        {
+            // grow the tree by one level
+            InternalNode *top = Pool<InternalNode>::create();
+            top->count = 1;
+            top->keys[0] = sep;
+            top->children[0] = nd;
+            top->children[1] = right;
+            root->children[0] = top;
+        }
+        else
+        {
+            // parent is not full, it would have been split on the way down
+            int pos = Search::upper(parent->keys, parent->count, sep, comp);
+            for (int i = parent->count; i > pos; i--)
+            {
+                parent->keys[i] = parent->keys[i - 1];
+                parent->children[i + 1] = parent->children[i];
+            }
+            parent->keys[pos] = sep;
+            parent->children[pos + 1] = right;
+            parent->count += 1;
+        }
+
+        nd->lock.unlock();
+        parent->lock.unlock();
+    }
+
+    int depth() // not thread-safe
+    {
+        int d = 0;
+        for (Node *nd = root->children[0]; !nd->is_leaf; nd = ((InternalNode *)nd)->children[0])
+            d++;
+        return d + 1;
+    }
+};
+
+// Churn on a tiny hot key range, counts how failed validations were retried.
+// Every one of them used to restart from the root.
+template <typename Tree>
+void retry_test(const std::string &name, int thread_count, int ops_count, int elem_max)
+{
+    Tree tree;
+    for (int k = 1; k <= elem_max; k += 2)
+        tree.insert(tree.root, k, k);
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                int key = gen() % elem_max + 1;
+                if (gen() % 100 < 50)
+                    tree.insert(tree.root, key, key);
+                else
+                    tree.remove(tree.root, key);
+            } }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::cout << name << " : " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms, "
+              << tree.stats.local_retries.load() << " local retries, "
+              << tree.stats.root_restarts.load() << " root restarts" << std::endl;
+}
+
+// Random lookups of present keys, on a tree built from n keys inserted in random order
+template <typename Tree>
+void lookup_test(const std::string &name, int thread_count, int n, int ops_count)
+{
+    Tree tree;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = i + 1;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+    for (int key : keys)
+        tree.insert(tree.root, key, key);
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                bool found = tree.search(tree.root, gen() % n + 1);
+                assert(found);
+            } }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << name << " : " << ms << "ms, " << (long long)ops_count / (ms + 1) << " ops/ms" << std::endl;
+}
+
+// One thread pages through [lo, elem_max] scan_len keys at a time while writers churn the tree.
+template <typename Tree>
+void scan_test(const std::string &name, int writer_count, int elem_max, int scan_len, int millis)
+{
+    Tree tree;
+    std::vector<int> keys;
+    for (int k = 1; k <= elem_max; k += 2)
+        keys.push_back(k);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+    for (int key : keys)
+        tree.insert(tree.root, key, key);
+
+    std::atomic<bool> stop(false);
+    std::atomic<long long> writes(0);
+    std::vector<std::thread> threads;
+    for (int id = 0; id < writer_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            long long ops = 0;
+            for (; !stop.load(std::memory_order_relaxed); ops++)
+            {
+                int key = gen() % elem_max + 1;
+                if (gen() % 100 < 50)
+                    tree.insert(tree.root, key, key);
+                else
+                    tree.remove(tree.root, key);
+            }
+            writes += ops; }));
+    }
+
+    std::vector<std::pair<int, int>> page(scan_len);
+    std::mt19937 gen(writer_count);
+    long long scans = 0, scanned = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (std::chrono::high_resolution_clock::now() - start < std::chrono::milliseconds(millis))
+    {
+        int count = tree.scan(tree.root, gen() % elem_max + 1, elem_max, page.data(), scan_len);
+        for (int i = 1; i < count; i++)
+            assert(page[i - 1].first < page[i].first);
+        scans += 1;
+        scanned += count;
+    }
+    stop.store(true);
+    for (auto &t : threads)
+        t.join();
+
+    std::cout << name << " : " << scans * 1000 / millis << " scans/s, " << scanned / millis << " keys/ms, writers "
+              << writes.load() / millis << " ops/ms" << std::endl;
+}
+
+// Counter workload : threads bump the values of random keys out of n, by update(v + 1),
+// insert_or_assign, or the remove + insert a value change used to take.
+template <typename Tree>
+void update_test(const std::string &mode, int thread_count, int n, int ops_count)
+{
+    Tree tree;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = i + 1;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+    for (int key : keys)
+        tree.insert(tree.root, key, 0);
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            for (int i = 0; i < ops_count / thread_count; i++)
+            {
+                int key = gen() % n + 1;
+                if (mode == "update")
+                    tree.update(tree.root, key, [](int v)
+                                { return v + 1; });
+                else if (mode == "upsert")
+                    tree.insert_or_assign(tree.root, key, i);
+                else
+                {
+                    tree.remove(tree.root, key);
+                    tree.insert(tree.root, key, i);
+                }
+            } }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    if (mode == "update")
+    {
+        // no increment lost
+        std::vector<std::pair<int, int>> all(n);
+        assert(tree.scan(tree.root, 1, n, all.data(), n) == n);
+        long long total = 0;
+        for (auto &kv : all)
+            total += kv.second;
+        assert(total == (long long)ops_count / thread_count * thread_count);
+    }
+    std::cout << mode << " : " << ms << "ms, " << (long long)ops_count / (ms + 1) << " ops/ms" << std::endl;
+}
+
+// update(v + 1) on random keys out of n while one thread removes and re-inserts them with 0.
+// The remover reads each leaf it removed under an outer guard, so the increments lost with
+// it are known. Every successful update must show up exactly once : in a removed leaf or in
+// the final tree, and fn must run once per success.
+template <typename Tree>
+void update_remove_test(int thread_count, int n, int ops_count)
+{
+    Tree tree;
+    for (int k = 1; k <= n; k++)
+        tree.insert(tree.root, k, 0);
+
+    std::atomic<long long> successes(0), calls(0), lost(0);
+    std::atomic<int> running(thread_count);
+    std::vector<std::thread> threads;
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            std::mt19937 gen(id);
+            long long local = 0;
+            for (int i = 0; i < ops_count / thread_count; i++)
+                local += tree.update(tree.root, gen() % n + 1, [&](int v)
+                                     {
+                    calls.fetch_add(1, std::memory_order_relaxed);
+                    return v + 1; });
+            successes.fetch_add(local);
+            running--; }));
+    }
+    threads.push_back(std::thread([&]()
+                                  {
+        std::mt19937 gen(thread_count);
+        while (running.load() > 0)
+        {
+            int key = gen() % n + 1;
+            typename Tree::Guard guard(tree.reclaimer); // keeps the removed leaf readable
+            auto leaf = tree.find(tree.root, key).leaf;
+            assert(tree.remove(tree.root, key)); // only this thread removes
+            lost += leaf->value.load();
+            assert(tree.insert(tree.root, key, 0));
+        } }));
+    for (auto &t : threads)
+        t.join();
+
+    std::vector<std::pair<int, int>> all(n);
+    assert(tree.scan(tree.root, 1, n, all.data(), n) == n);
+    long long total = lost.load();
+    for (auto &kv : all)
+        total += kv.second;
+    assert(total == successes.load() && calls.load() == successes.load());
+    std::cout << thread_count << " updaters : " << successes.load() << " updates, " << lost.load() << " removed with their leaves" << std::endl;
+}
+
+// Keys from a zipf distribution over [1, n] (rank r has weight 1 / r^s), small keys hottest.
+struct ZipfGenerator
+{
+    std::vector<double> cdf;
+
+    ZipfGenerator(int n, double s = 0.99) : cdf(n)
+    {
+        double total = 0;
+        for (int r = 1; r <= n; r++)
+            cdf[r - 1] = total += 1 / std::pow(r, s);
+        for (double &c : cdf)
+            c /= total;
+    }
+
+    template <typename Gen>
+    int operator()(Gen &gen)
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(gen);
+        return std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin() + 1;
+    }
+};
+
+// Fill a tree with n inserts split over threads, in sequential, random or zipf key order,
+// then report depth and the throughput of n single threaded lookups.
+template <typename Tree>
+void depth_test(const std::string &name, const std::string &order, int thread_count, int n)
+{
+    std::vector<std::vector<int>> keys(thread_count);
+    if (order == "zipf")
+    {
+        ZipfGenerator zipf(n);
+        std::mt19937 gen(0);
+        for (int i = 0; i < n; i++)
+            keys[i % thread_count].push_back(zipf(gen));
+    }
+    else
+    {
+        std::vector<int> all(n);
+        for (int i = 0; i < n; i++)
+            all[i] = i + 1;
+        if (order == "random")
+            std::shuffle(all.begin(), all.end(), std::mt19937(0));
+        for (int i = 0; i < n; i++)
+            keys[i % thread_count].push_back(all[i]); // sequential : threads append interleaved keys
+    }
+
+    Tree tree;
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int id = 0; id < thread_count; id++)
+    {
+        threads.push_back(std::thread([&, id]()
+                                      {
+            for (int key : keys[id])
+                tree.insert(tree.root, key, key); }));
+    }
+    for (auto &t : threads)
+        t.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    std::mt19937 gen(1);
+    auto lookup_start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; i++)
+        tree.search(tree.root, gen() % n + 1);
+    auto lookup_end = std::chrono::high_resolution_clock::now();
+    long lookup_ms = std::chrono::duration_cast<std::chrono::milliseconds>(lookup_end - lookup_start).count();
+
+    std::cout << name << " " << order << " : depth " << tree.depth() << ", inserts " << (long long)n / (ms + 1)
+              << " ops/ms, lookups " << (long long)n / (lookup_ms + 1) << " ops/ms" << std::endl;
+}
+
+// Time to fill a tree with keys 1..n by shuffled inserts and by bulk loading, then lookups.
+void bulk_test(int n, int thread_count)
+{
+    typedef LeafTree<> Tree;
+    std::vector<std::pair<int, int>> items(n);
+    for (int i = 0; i < n; i++)
+        items[i] = {i + 1, i + 1};
+
+    auto lookups = [&](Tree &tree)
+    {
+        std::mt19937 gen(0);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < 1000000; i++)
+        {
+            bool found = tree.search(tree.root, gen() % n + 1);
+            assert(found);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return (long long)1000000 / (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() + 1);
+    };
+
+    {
+        std::vector<std::pair<int, int>> shuffled = items;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(0));
+        auto start = std::chrono::high_resolution_clock::now();
+        Tree tree;
+        for (auto &kv : shuffled)
+            tree.insert(tree.root, kv.first, kv.second);
+        auto end = std::chrono::high_resolution_clock::now();
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        std::cout << "inserts        : " << ms << "ms, lookups " << lookups(tree) << " ops/ms" << std::endl;
+    }
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        Tree tree(items.begin(), items.end(), thread_count);
+        auto end = std::chrono::high_resolution_clock::now();
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+        std::cout << "bulk load (" << thread_count << " th) : " << ms << "ms, lookups " << lookups(tree) << " ops/ms" << std::endl;
+    }
+}
+
+long rss_kb()
+{
+    // resident set size from /proc (linux only)
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Write-heavy insert/remove churn on a small key range.
+// Reports throughput and how much RSS grew while churning. Each thread owns the keys equal
+// to its id mod thread_count and tracks them, and the tree must agree at the end.
+template <typename Tree>
+void churn_test(const std::string &name, int thread_count, int rounds, int ops_per_round, int elem_max)
+{
+    Tree tree;
+    std::vector<std::set<int>> owned(thread_count);
+    for (int k = 1; k <= elem_max; k += 2)
+    {
+        tree.insert(tree.root, k, k);
+        owned[k % thread_count].insert(k);
+    }
+
+    long rss_start = rss_kb();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<std::thread> threads;
+        for (int id = 0; id < thread_count; id++)
+        {
+            threads.push_back(std::thread([&, id]()
+                                          {
+                std::mt19937 gen(r * 1000 + id);
+                std::set<int> &keys = owned[id];
+                for (int i = 0; i < ops_per_round / thread_count; i++)
+                {
+                    int key = (gen() % elem_max + 1) / thread_count * thread_count + id;
+                    if (key < 1 || key > elem_max)
+                        continue;
+                    if (gen() % 100 < 50)
+                    {
+                        bool inserted = tree.insert(tree.root, key, key);
+                        assert(inserted == !keys.count(key));
+                        keys.insert(key);
+                    }
+                    else
+                    {
+                        bool removed = tree.remove(tree.root, key);
+                        assert(removed == (bool)keys.count(key));
+                        keys.erase(key);
+                    }
+                } }));
+        }
+        for (auto &t : threads)
+            t.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    long long ops = (long long)rounds * ops_per_round;
+
+    for (int k = 1; k <= elem_max; k++)
+        assert(tree.search(tree.root, k) == (bool)owned[k % thread_count].count(k));
+
+    std::cout << name << " : " << ms << "ms, " << ops / (ms + 1) << " ops/ms, RSS growth " << (rss_kb() - rss_start) << "KB" << std::endl;
+}
+
+int main()
+{
+    LeafTree<>::debug_info();
+    LeafTree<long long, long long>::debug_info();
+    LeafTree<FixedKey<16>, long long>::debug_info();
+
+    // Basic tests for insert, remove and search
+    {
+        LeafTree<> tree;
+        assert(!tree.search(tree.root, 1));
+        assert(tree.insert(tree.root, 1, 10));
+        assert(tree.insert(tree.root, 3, 30));
+        assert(tree.insert(tree.root, 2, 20));
+        assert(!tree.insert(tree.root, 2, 20));
+        assert(tree.search(tree.root, 1) && tree.search(tree.root, 2) && tree.search(tree.root, 3));
+        assert(tree.remove(tree.root, 2));
+        assert(!tree.remove(tree.root, 2));
+        assert(!tree.search(tree.root, 2));
+        assert(tree.remove(tree.root, 1) && tree.remove(tree.root, 3));
+        assert(!tree.search(tree.root, 1) && !tree.search(tree.root, 3));
+    }
+
+    // Range scans, hazard pointers (successor searches) and epochs (stack walk)
+    {
+        auto check_scan = [](auto &tree)
+        {
+            std::pair<int, int> page[64];
+            assert(tree.scan(tree.root, 1, 100, page, 64) == 0);
+            for (int k = 100; k >= 1; k--)
+                tree.insert(tree.root, k, k * 10);
+            assert(tree.scan(tree.root, 10, 14, page, 64) == 5 && page[0] == std::make_pair(10, 100) && page[4].first == 14);
+            assert(tree.scan(tree.root, 10, 14, page, 64, false) == 4 && page[0].first == 11);
+            assert(tree.scan(tree.root, 10, 1000, page, 3) == 3 && page[2].first == 12);
+            int total = 0, last = 0;
+            for (int count = 0; (count = tree.scan(tree.root, last, 1000, page, 7, false)) > 0; last = page[count - 1].first)
+                total += count;
+            assert(total == 100 && last == 100);
+        };
+        LeafTree<> hazard_tree;
+        check_scan(hazard_tree);
+        LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>> epoch_tree;
+        check_scan(epoch_tree);
+    }
+
+    // Values changed in place
+    {
+        LeafTree<> tree;
+        assert(tree.insert_or_assign(tree.root, 1, 10) && !tree.insert_or_assign(tree.root, 1, 20));
+        assert(tree.update(tree.root, 1, [](int v)
+                           { return v + 1; }));
+        assert(!tree.update(tree.root, 2, [](int v)
+                            { return v + 1; }));
+        std::pair<int, int> page[2];
+        assert(tree.scan(tree.root, 1, 2, page, 2) == 1 && page[0].second == 21);
+        assert(tree.remove(tree.root, 1) && tree.insert_or_assign(tree.root, 1, 5));
+        assert(tree.scan(tree.root, 1, 2, page, 2) == 1 && page[0].second == 5);
+    }
+
+    // Counters on 100k keys
+    std::cout << " --- Update test --- " << std::endl;
+    for (int ths : {1, 4})
+    {
+        std::cout << ths << " threads" << std::endl;
+        for (std::string mode : {"remove + insert", "upsert", "update"})
+            update_test<LeafTree<>>(mode, ths, 100000, 2000000);
+    }
+    for (int ths : {1, 4})
+        update_remove_test<LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>>>(ths, 64, 1000000);
+    std::cout << " --- End of update test --- " << std::endl
+              << std::endl;
+
+    // Scans of 100 keys under concurrent updates
+    std::cout << " --- Scan test --- " << std::endl;
+    for (int ths : {0, 1, 4})
+    {
+        std::cout << ths << " writers" << std::endl;
+        scan_test<LeafTree<>>("hazard", ths, 100000, 100, 1000);
+        scan_test<LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>>>("epoch ", ths, 100000, 100, 1000);
+    }
+    std::cout << " --- End of scan test --- " << std::endl
+              << std::endl;
+
+    // Validation failures on a hot key range
+    std::cout << " --- Retry test --- " << std::endl;
+    for (int ths : {4, 16, 64})
+    {
+        std::cout << ths << " threads" << std::endl;
+        retry_test<LeafTree<>>("hazard", ths, 2000000, 16);
+        retry_test<LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>>>("epoch ", ths, 2000000, 16);
+    }
+    std::cout << " --- End of retry test --- " << std::endl
+              << std::endl;
+
+    // Reclamation: leak everything vs hazard pointers
+    std::cout << " --- Churn test --- " << std::endl;
+    for (int ths : {1, 4, 8})
+    {
+        std::cout << ths << " threads" << std::endl;
+        churn_test<LeafTree<int, int, std::less<int>, LeakReclaimer<Node<int>, NodeAllocator<int, int>>>>("leak  ", ths, 20, 200000, 1000);
+        churn_test<LeafTree<int, int, std::less<int>, HazardReclaimer<Node<int>, NodeAllocator<int, int>>>>("hazard", ths, 20, 200000, 1000);
+    }
+    std::cout << " --- End of churn test --- " << std::endl
+              << std::endl;
+
+    // Allocation: global new vs thread local node pool
+    std::cout << " --- Allocator test --- " << std::endl;
+    for (int ths : {1, 4, 8, 16})
+    {
+        std::cout << ths << " threads" << std::endl;
+        churn_test<LeafTree<int, int, std::less<int>, HazardReclaimer<Node<int>, NodeAllocator<int, int, NewAllocator>>>>("new ", ths, 20, 200000, 1000);
+        churn_test<LeafTree<int, int, std::less<int>, HazardReclaimer<Node<int>, NodeAllocator<int, int, NodePool>>>>("pool", ths, 20, 200000, 1000);
+    }
+    std::cout << " --- End of allocator test --- " << std::endl
+              << std::endl;
+
+    // Key types
+    std::cout << " --- Key type test --- " << std::endl;
+    {
+        LeafTree<FixedKey<16>, long long> tree;
+        assert(tree.insert(tree.root, "banana", 2));
+        assert(tree.insert(tree.root, "apple", 1));
+        assert(tree.insert(tree.root, "cherry", 3));
+        assert(!tree.insert(tree.root, "apple", 4));
+        assert(tree.search(tree.root, "banana") && !tree.search(tree.root, "durian"));
+        assert(tree.remove(tree.root, "banana") && !tree.search(tree.root, "banana"));
+
+        LeafTree<int, int, std::greater<int>> desc; // sentinel sorts first here, which is fine
+        assert(desc.insert(desc.root, 1, 1) && desc.insert(desc.root, 3, 3) && desc.insert(desc.root, 2, 2));
+        assert(desc.remove(desc.root, 3) && !desc.search(desc.root, 3) && desc.search(desc.root, 1));
+    }
+    for (int ths : {1, 8})
+    {
+        std::cout << ths << " threads" << std::endl;
+        churn_test<LeafTree<int, int>>("int      ", ths, 20, 200000, 1000);
+        churn_test<LeafTree<long long, long long>>("long long", ths, 20, 200000, 1000);
+    }
+    std::cout << " --- End of key type test --- " << std::endl
+              << std::endl;
+
+    // Synchronization: per-node locks vs lock-free, both with epoch reclamation
+    std::cout << " --- Lock-free test --- " << std::endl;
+    {
+        LockFreeLeafTree<> tree;
+        assert(!tree.search(tree.root, 1));
+        assert(tree.insert(tree.root, 1, 10));
+        assert(tree.insert(tree.root, 3, 30));
+        assert(tree.insert(tree.root, 2, 20));
+        assert(!tree.insert(tree.root, 2, 20));
+        assert(tree.search(tree.root, 1) && tree.search(tree.root, 2) && tree.search(tree.root, 3));
+        assert(tree.remove(tree.root, 2));
+        assert(!tree.remove(tree.root, 2));
+        assert(!tree.search(tree.root, 2));
+        assert(tree.remove(tree.root, 1) && tree.remove(tree.root, 3));
+        assert(!tree.search(tree.root, 1) && !tree.search(tree.root, 3));
+    }
+    for (int ths : {1, 2, 4, 8, 16, 32, 64})
+    {
+        std::cout << ths << " threads" << std::endl;
+        churn_test<LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>>>("locked   ", ths, 20, 200000, 1000);
+        churn_test<LockFreeLeafTree<>>("lock-free", ths, 20, 200000, 1000);
+    }
+    std::cout << " --- End of lock-free test --- " << std::endl
+              << std::endl;
+
+    // Fat nodes: binary LeafTree vs B+-tree with 16 keys per node
+    std::cout << " --- B-tree test --- " << std::endl;
+    {
+        OLCBTree<> tree;
+        assert(!tree.search(tree.root, 1));
+        for (int k = 1; k <= 1000; k++)
+            assert(tree.insert(tree.root, k, k));
+        assert(!tree.insert(tree.root, 500, 500));
+        for (int k = 1; k <= 1000; k += 2)
+            assert(tree.remove(tree.root, k));
+        assert(!tree.remove(tree.root, 1));
+        for (int k = 1; k <= 1000; k++)
+            assert(tree.search(tree.root, k) == (k % 2 == 0));
+
+        OLCBTree<FixedKey<16>, long long> str_tree; // generic keys use a binary search in the node
+        assert(str_tree.insert(str_tree.root, "banana", 2) && str_tree.insert(str_tree.root, "apple", 1));
+        assert(str_tree.search(str_tree.root, "apple") && !str_tree.search(str_tree.root, "cherry"));
+    }
+    // the 100M point needs about 6GB, set LARGE_TESTS=1 to run it
+    std::vector<int> sizes = {1000000, 10000000};
+    if (std::getenv("LARGE_TESTS") != nullptr)
+        sizes.push_back(100000000);
+    for (int n : sizes)
+    {
+        for (int ths : {1, 4})
+        {
+            std::cout << n << " keys, " << ths << " threads" << std::endl;
+            lookup_test<LeafTree<>>("binary", ths, n, 2000000);
+            lookup_test<OLCBTree<>>("b-tree", ths, n, 2000000);
+        }
+    }
+    churn_test<OLCBTree<>>("b-tree churn", 8, 20, 200000, 1000);
+    std::cout << " --- End of B-tree test --- " << std::endl
+              << std::endl;
+
+    // Balanced tree from sorted input
+    std::cout << " --- Bulk load test --- " << std::endl;
+    {
+        for (int n : {0, 1, 2, 3, 1000})
+        {
+            std::vector<std::pair<int, int>> items;
+            for (int k = 1; k <= n; k++)
+                items.push_back({k * 2, k});
+            LeafTree<> tree(items.begin(), items.end(), 4);
+            for (int k = 1; k <= n; k++)
+                assert(tree.search(tree.root, k * 2) && !tree.search(tree.root, k * 2 + 1));
+            std::pair<int, int> page[1000];
+            assert(tree.scan(tree.root, 0, 1 << 30, page, 1000) == n && std::equal(page, page + n, items.begin()));
+            assert(tree.insert(tree.root, 1, 0) && tree.insert(tree.root, n * 2 + 3, 0));
+            for (int k = 1; k <= n; k++)
+                assert(tree.remove(tree.root, k * 2));
+            assert(tree.scan(tree.root, 0, 1 << 30, page, 1000) == 2);
+        }
+
+        std::vector<std::pair<int, int>> items = {{5, 5}, {3, 3}, {1, 1}}; // decreasing for std::greater
+        LeafTree<int, int, std::greater<int>> tree(items.begin(), items.end());
+        assert(tree.search(tree.root, 3) && !tree.search(tree.root, 2));
+        assert(tree.insert(tree.root, 4, 4) && tree.remove(tree.root, 5));
+    }
+    for (int n : {1000000, 10000000})
+    {
+        std::cout << n << " keys" << std::endl;
+        bulk_test(n, 4);
+    }
+    std::cout << " --- End of bulk load test --- " << std::endl
+              << std::endl;
+
+    // Relaxed AVL balance against the unbalanced LeafTree
+    std::cout << " --- Balance test --- " << std::endl;
+    {
+        RelaxedAVLTree<> tree;
+        const int n = 100000;
+        for (int k = 1; k <= n; k++)
+            assert(tree.insert(tree.root, k, k));
+        assert(!tree.insert(tree.root, 5, 5));
+        assert(tree.depth() <= 1.45 * std::log2(n + 2) + 1); // AVL height bound, plus the root's child
+        for (int k = 1; k <= n; k++)
+            assert(tree.search(tree.root, k));
+        for (int k = 1; k <= n; k += 3)
+            assert(tree.remove(tree.root, k));
+        for (int k = 1; k <= n; k++)
+            assert(tree.search(tree.root, k) == (k % 3 != 1));
+        for (int k = 2 * n / 3; k <= n; k++)
+            tree.remove(tree.root, k);
+        assert(tree.depth() <= 1.45 * std::log2(n + 2) + 1);
+
+        std::vector<std::pair<int, int>> items = {{1, 1}, {2, 2}, {3, 3}}; // bulk loaded heights are right
+        RelaxedAVLTree<> small(items.begin(), items.end());
+        for (int k = 4; k <= 1000; k++)
+            small.insert(small.root, k, k);
+        assert(small.depth() <= 1.45 * std::log2(1000 + 2) + 1);
+    }
+    for (int ths : {1, 4})
+    {
+        std::cout << ths << " threads" << std::endl;
+        for (std::string order : {"sequential", "random", "zipf"})
+        {
+            depth_test<LeafTree<int, int, std::less<int>, EpochReclaimer<Node<int>, NodeAllocator<int, int>>>>("binary", order, ths, 30000);
+            depth_test<RelaxedAVLTree<>>("avl   ", order, ths, 30000);
+        }
+    }
+    std::cout << " --- End of balance test --- " << std::endl;
+
+    return 0;
+}
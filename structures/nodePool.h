@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+const size_t CACHE_LINE = 64;
+
+// Allocation policies for nodes.
+// Both expose create(args...) and destroy(node), so data structures and reclaimers can be
+// written once and benchmarked against either.
+
+template <typename T>
+struct NewAllocator
+{
+    // plain global new / delete
+    template <typename... Args>
+    static T *create(Args &&...args)
+    {
+        return new T(std::forward<Args>(args)...);
+    }
+    static void destroy(T *node)
+    {
+        delete node;
+    }
+};
+
+template <typename T>
+struct NodePool
+{
+    // Thread local free lists of fixed size blocks carved from cache line aligned slabs.
+    // A block is a power of two up to a cache line (a multiple of it above), so no node
+    // straddles two lines. Freed blocks go to the freeing thread's list. When that list grows
+    // past two batches, or the thread exits, whole batches move to a shared depot which
+    // threads refill from before carving a new slab. Slabs are only returned at exit.
+    static constexpr size_t block_size()
+    {
+        size_t size = sizeof(T) < sizeof(void *) ? sizeof(void *) : sizeof(T);
+        if (size > CACHE_LINE)
+            return (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        size_t block = sizeof(void *);
+        while (block < size)
+            block *= 2;
+        return block;
+    }
+    static const size_t BLOCK_SIZE = block_size();
+    static const size_t SLAB_SIZE = 64 * 1024;
+    static const int SLAB_BLOCKS = SLAB_SIZE / BLOCK_SIZE > 0 ? SLAB_SIZE / BLOCK_SIZE : 1;
+    static const int BATCH = 256;
+
+    struct Block
+    {
+        Block *next;
+    };
+
+    struct Batch
+    {
+        Block *head;
+        int count;
+    };
+
+    struct Depot
+    {
+        std::mutex mtx;
+        std::vector<Batch> batches;
+        std::vector<void *> slabs;
+
+        ~Depot()
+        {
+            for (void *slab : slabs)
+                ::operator delete(slab, std::align_val_t(CACHE_LINE));
+        }
+    };
+
+    struct Cache
+    {
+        Block *head = nullptr;
+        int count = 0;
+
+        ~Cache()
+        {
+            // hand everything to the depot when the thread exits
+            if (count > 0)
+                give(Batch{head, count});
+        }
+    };
+
+    static Depot &depot()
+    {
+        static Depot d;
+        return d;
+    }
+    static inline thread_local Cache cache;
+
+    template <typename... Args>
+    static T *create(Args &&...args)
+    {
+        return new (allocate()) T(std::forward<Args>(args)...);
+    }
+
+    static void destroy(T *node)
+    {
+        node->~T();
+        deallocate(node);
+    }
+
+    static void *allocate()
+    {
+        Cache &c = cache;
+        if (c.head == nullptr)
+            refill(c);
+        Block *b = c.head;
+        c.head = b->next;
+        c.count -= 1;
+        return b;
+    }
+
+    static void deallocate(void *ptr)
+    {
+        Cache &c = cache;
+        Block *b = (Block *)ptr;
+        b->next = c.head;
+        c.head = b;
+        c.count += 1;
+        if (c.count >= 2 * BATCH)
+        {
+            // split off one batch for other threads
+            Block *last = c.head;
+            for (int i = 1; i < BATCH; i++)
+                last = last->next;
+            Batch batch{c.head, BATCH};
+            c.head = last->next;
+            c.count -= BATCH;
+            last->next = nullptr;
+            give(batch);
+        }
+    }
+
+    static void give(Batch batch)
+    {
+        Depot &d = depot();
+        std::lock_guard<std::mutex> lock(d.mtx);
+        d.batches.push_back(batch);
+    }
+
+    static void refill(Cache &c)
+    {
+        Depot &d = depot();
+        {
+            std::lock_guard<std::mutex> lock(d.mtx);
+            if (!d.batches.empty())
+            {
+                c.head = d.batches.back().head;
+                c.count = d.batches.back().count;
+                d.batches.pop_back();
+                return;
+            }
+        }
+
+        char *slab = (char *)::operator new(SLAB_BLOCKS * BLOCK_SIZE, std::align_val_t(CACHE_LINE));
+        {
+            std::lock_guard<std::mutex> lock(d.mtx);
+            d.slabs.push_back(slab);
+        }
+        for (int i = SLAB_BLOCKS - 1; i >= 0; i--)
+        {
+            Block *b = (Block *)(slab + i * BLOCK_SIZE);
+            b->next = c.head;
+            c.head = b;
+        }
+        c.count = SLAB_BLOCKS;
+    }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Tell the core we are busy waiting (no-op where there is no such hint)
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+struct Backoff
+{
+    // Exponential backoff for busy waits. Yields after a while so a preempted lock holder
+    // gets to run when threads outnumber cores.
+    static const int MAX_SPINS = 1024; // pauses per wait before falling back to yield
+    int spins = 1;
+
+    void pause()
+    {
+        if (spins < MAX_SPINS)
+        {
+            for (int i = 0; i < spins; i++)
+                cpu_relax();
+            spins *= 2;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+};
+
+struct SpinLock
+{
+    // Test and test-and-set lock in a single byte, for per-node locks where a std::mutex
+    // (40 bytes on glibc) would be most of the node.
+    // Waiters spin on a plain load so the line is only written once it looks free.
+    // Same lock() / try_lock() / unlock() as std::mutex.
+    std::atomic<bool> locked{false};
+
+    void lock()
+    {
+        Backoff backoff;
+        while (locked.exchange(true, std::memory_order_acquire))
+        {
+            while (locked.load(std::memory_order_relaxed))
+                backoff.pause();
+        }
+    }
+
+    bool try_lock()
+    {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        locked.store(false, std::memory_order_release);
+    }
+};
+
+struct VersionLock
+{
+    // Version lock for optimistic lock coupling (Leis et al.), a seqlock with CAS upgrade.
+    // The word is odd while write locked, and each write lock / unlock pair advances it by 2.
+    // Readers take no lock: they remember the version, read, then validate() that it did not
+    // move, and discard what they read (restart) if it did. Writers either lock() outright or
+    // upgrade() from a version they read, which fails if anyone wrote in between.
+    std::atomic<uint64_t> word{0};
+
+    // waits until unlocked, returns the version to validate against
+    uint64_t read_lock() const
+    {
+        Backoff backoff;
+        uint64_t v = word.load(std::memory_order_acquire);
+        while (v & 1)
+        {
+            backoff.pause();
+            v = word.load(std::memory_order_acquire);
+        }
+        return v;
+    }
+
+    // true if nothing was written since read_lock() returned v
+    bool validate(uint64_t v) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire); // order the reads before the check
+        return word.load(std::memory_order_relaxed) == v;
+    }
+
+    bool upgrade(uint64_t v)
+    {
+        return word.compare_exchange_strong(v, v + 1, std::memory_order_acquire);
+    }
+
+    void lock()
+    {
+        while (!upgrade(read_lock()))
+            ;
+    }
+
+    void unlock()
+    {
+        word.fetch_add(1, std::memory_order_release);
+    }
+};